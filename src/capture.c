@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <osso-log.h>
+#include <systemui.h>
+
+#include "capture.h"
+
+static FILE *capture_file = NULL;
+static gint64 start_time = 0;
+static guint flush_id = 0;
+static guint captured = 0;
+
+static void
+capture_put_u32(guint8 *p, guint32 v)
+{
+  v = GUINT32_TO_LE(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+static void
+capture_put_u64(guint8 *p, guint64 v)
+{
+  v = GUINT64_TO_LE(v);
+  memcpy(p, &v, sizeof(v));
+}
+
+static void
+capture_failed(void)
+{
+  SYSTEMUI_ERROR("Capture write failed, stopping: %s", strerror(errno));
+  fclose(capture_file);
+  capture_file = NULL;
+}
+
+/* a stall is what we are after, keep at most a second in the buffer */
+static gboolean
+capture_flush(gpointer user_data)
+{
+  flush_id = 0;
+
+  if (capture_file && fflush(capture_file))
+    capture_failed();
+
+  return FALSE;
+}
+
+void
+capture_message(DBusMessage *msg, guint8 bus)
+{
+  guint8 header[CAPTURE_RECORD_HEADER_SIZE] = {0};
+  char *data = NULL;
+  int len = 0;
+
+  if (!capture_file)
+    return;
+
+  if (!dbus_message_marshal(msg, &data, &len))
+  {
+    SYSTEMUI_WARNING("Cannot marshal message for capture");
+    return;
+  }
+
+  capture_put_u64(header, g_get_monotonic_time() - start_time);
+  capture_put_u32(header + 8, len);
+  header[12] = bus;
+
+  if (fwrite(header, sizeof(header), 1, capture_file) != 1 ||
+      fwrite(data, len, 1, capture_file) != 1)
+  {
+    capture_failed();
+  }
+  else
+  {
+    captured++;
+
+    if (!flush_id)
+      flush_id = systemui_timeout_add_seconds(1, capture_flush, NULL);
+  }
+
+  dbus_free(data);
+}
+
+gboolean
+capture_init(const char *file)
+{
+  guint8 header[CAPTURE_HEADER_SIZE] = {0};
+
+  if (!(capture_file = fopen(file, "wb")))
+  {
+    SYSTEMUI_ERROR("Cannot open capture file %s: %s", file, strerror(errno));
+    return FALSE;
+  }
+
+  memcpy(header, CAPTURE_MAGIC, 8);
+  capture_put_u32(header + 8, CAPTURE_VERSION);
+  capture_put_u64(header + 16, g_get_real_time());
+  start_time = g_get_monotonic_time();
+
+  if (fwrite(header, sizeof(header), 1, capture_file) != 1)
+  {
+    capture_failed();
+    return FALSE;
+  }
+
+  ULOG_INFO("Capturing incoming messages to %s", file);
+
+  return TRUE;
+}
+
+void
+capture_finish(void)
+{
+  if (flush_id)
+  {
+    systemui_timeout_remove(flush_id);
+    flush_id = 0;
+  }
+
+  if (!capture_file)
+    return;
+
+  if (fclose(capture_file))
+    SYSTEMUI_ERROR("Cannot close capture file: %s", strerror(errno));
+  else
+    ULOG_INFO("Captured %u messages", captured);
+
+  capture_file = NULL;
+}
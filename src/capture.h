@@ -0,0 +1,27 @@
+#ifndef SYSTEMUI_CAPTURE_H
+#define SYSTEMUI_CAPTURE_H
+
+/*
+ * Capture file, all integers little endian:
+ *
+ *   header  "SYSUICAP", u32 version, u32 reserved,
+ *           u64 wall clock time of the capture start in usecs
+ *   record  u64 usecs since the capture start, u32 length, u8 bus,
+ *           3 bytes padding, length bytes of dbus_message_marshal() output
+ *
+ * Method calls to systemui and the signals it receives are captured as they
+ * come in, before rate limiting and queueing.
+ */
+#define CAPTURE_MAGIC "SYSUICAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 24
+#define CAPTURE_RECORD_HEADER_SIZE 16
+
+#define CAPTURE_BUS_SYSTEM 0
+#define CAPTURE_BUS_SESSION 1
+
+gboolean capture_init(const char *file);
+void capture_message(DBusMessage *msg, guint8 bus);
+void capture_finish(void);
+
+#endif // SYSTEMUI_CAPTURE_H
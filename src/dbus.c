@@ -1,7 +1,5 @@
 #include <locale.h>
 #include <libintl.h>
-#include <canberra.h>
-#include <mce/dbus-names.h>
 #include <systemui/dbus-names.h>
 #include <osso-log.h>
 #include <systemui.h>
@@ -11,11 +9,20 @@
 
 #include "config.h"
 
-#ifdef WITH_HILDON
-#include <hildon/hildon-banner.h>
-#endif
-
+#include "capture.h"
 #include "dbus.h"
+#include "dispatch.h"
+#include "i18n.h"
+#include "ipm.h"
+#include "plugin.h"
+#include "ratelimit.h"
+#include "ready.h"
+#include "signals.h"
+#include "stats.h"
+#include "thermal.h"
+#include "trace.h"
+#include "wakeup.h"
+#include "watchdog.h"
 
 /* Those are supposed to be in some osso-locale.h file, can't find it */
 #define LOCALE_CHANGED_INTERFACE "com.nokia.LocaleChangeNotification"
@@ -23,8 +30,6 @@
 #define LOCALE_CHANGED_SIG_NAME "locale_changed"
 
 DBusConnection *session_bus = NULL;
-const gchar *vibrator_pattern = "PatternIncomingMessage";
-gboolean thermal_shutdown_started = FALSE;
 
 gboolean
 dbus_send_message(DBusConnection *dbus, DBusMessage *msg)
@@ -43,274 +48,944 @@ dbus_send_message(DBusConnection *dbus, DBusMessage *msg)
   }
 
   dbus_message_unref(msg);
+  stats_message_sent(dbus, TRUE);
+  SYSTEMUI_TRACE(TRACE_LEVEL_VERBOSE, TRACE_EV_SEND, NULL, TRUE,
+                 dbus_connection_get_outgoing_size(dbus), 0);
 
   return TRUE;
 
 err:
   dbus_message_unref(msg);
+  stats_message_sent(dbus, FALSE);
+  SYSTEMUI_TRACE(TRACE_LEVEL_VERBOSE, TRACE_EV_SEND, NULL, FALSE, 0, 0);
 
   return FALSE;
 }
 
-gboolean vibrator_deactivate(system_ui_data *ui)
+void
+dbus_iter_get_args(DBusMessageIter *iter, GArray *args)
 {
-  DBusMessage *msg;
+  int type;
 
-  msg = dbus_message_new_method_call(MCE_SERVICE,
-                                     MCE_REQUEST_PATH,
-                                     MCE_REQUEST_IF,
-                                     MCE_DEACTIVATE_VIBRATOR_PATTERN);
-  dbus_message_append_args(msg,
-                           DBUS_TYPE_STRING, &vibrator_pattern,
-                           DBUS_TYPE_INVALID);
-  dbus_send_message(ui->system_bus, msg);
+  while ((type = dbus_message_iter_get_arg_type(iter)) != DBUS_TYPE_INVALID)
+  {
+    system_ui_handler_arg arg;
 
-  return FALSE;
+    memset(&arg, 0, sizeof(arg));
+    arg.arg_type = type;
+
+    if (dbus_type_is_basic(type))
+    {
+      dbus_message_iter_get_basic(iter, &arg.data);
+
+      if (type == DBUS_TYPE_STRING)
+        arg.data.str = g_strdup(arg.data.str);
+    }
+    else
+    {
+      /* walked lazily by the handler, nothing is copied */
+      system_ui_container_arg_t *container =
+          g_slice_new(system_ui_container_arg_t);
+
+      container->element_type = type == DBUS_TYPE_ARRAY ?
+            dbus_message_iter_get_element_type(iter) : DBUS_TYPE_INVALID;
+      dbus_message_iter_recurse(iter, &container->sub);
+      arg.data.str = (char *)container;
+    }
+
+    g_array_append_vals(args, &arg, 1);
+    dbus_message_iter_next(iter);
+  }
 }
 
 void
-handle_thermal_notification(system_ui_data *ui, const char *state)
+dbus_free_args(GArray *args)
 {
-  if (!thermal_shutdown_started && state && !strcmp(state, "fatal") )
-  {
-    DBusMessage *msg;
-    ca_context *c = 0;
-    int ca_error;
-#ifdef WITH_HILDON
-    GtkWidget *banner;
-#endif
-    dbus_send_message(ui->system_bus,
-                      dbus_message_new_method_call(MCE_SERVICE,
-                                                   MCE_REQUEST_PATH,
-                                                   MCE_REQUEST_IF,
-                                                   MCE_DISPLAY_ON_REQ));
-
-    msg = dbus_message_new_method_call(MCE_SERVICE,
-                                       MCE_REQUEST_PATH,
-                                       MCE_REQUEST_IF,
-                                       MCE_ACTIVATE_VIBRATOR_PATTERN);
-    dbus_message_append_args(msg,
-                             DBUS_TYPE_STRING, &vibrator_pattern,
-                             DBUS_TYPE_INVALID);
-    dbus_send_message(ui->system_bus, msg);
-
-    g_timeout_add_seconds(2, (GSourceFunc)vibrator_deactivate, ui);
-
-    ca_error = ca_context_create(&c);
-    if (!ca_error)
+  int i;
+
+  for (i = 0; i < args->len; i++)
+  {
+    system_ui_handler_arg *arg = &((system_ui_handler_arg *)args->data)[i];
+
+    if (arg->arg_type == DBUS_TYPE_STRING)
+      g_free(arg->data.str);
+    else if (dbus_type_is_container(arg->arg_type))
     {
-      ca_error = ca_context_play(c, 0,
-                                 CA_PROP_MEDIA_FILENAME,
-                                 "/usr/share/sounds/ui-information_note.wav",
-                                 CA_PROP_MEDIA_NAME,
-                                 "Thermal Shutdown Notification",
-                                 NULL);
+      g_slice_free(system_ui_container_arg_t,
+                   (system_ui_container_arg_t *)arg->data.str);
     }
+  }
+
+  g_array_free(args, TRUE);
+}
+
+gboolean
+systemui_arg_recurse(const system_ui_handler_arg *arg, DBusMessageIter *sub)
+{
+  g_return_val_if_fail(arg != NULL && sub != NULL, FALSE);
+
+  if (!dbus_type_is_container(arg->arg_type))
+    return FALSE;
+
+  /* a copy, so the argument can be walked more than once */
+  *sub = ((system_ui_container_arg_t *)arg->data.str)->sub;
+
+  return TRUE;
+}
+
+gboolean
+systemui_arg_get_fixed_array(const system_ui_handler_arg *arg,
+                             int element_type, const void **elements,
+                             int *n_elements)
+{
+  system_ui_container_arg_t *container;
+  DBusMessageIter sub;
+
+  g_return_val_if_fail(arg != NULL && elements != NULL && n_elements != NULL,
+                       FALSE);
+
+  if (arg->arg_type != DBUS_TYPE_ARRAY || !dbus_type_is_fixed(element_type))
+    return FALSE;
+
+  container = (system_ui_container_arg_t *)arg->data.str;
+
+  if (container->element_type != element_type)
+    return FALSE;
+
+  sub = container->sub;
+  dbus_message_iter_get_fixed_array(&sub, (void *)elements, n_elements);
+
+  return TRUE;
+}
+
+/* the reply of the handler call in progress, created on first use */
+typedef struct
+{
+  system_ui_handler_arg *result;
+  DBusMessage *msg;
+  DBusMessage *reply;
+  DBusMessageIter iter;
+} dbus_reply_context_t;
 
-    if (ca_error)
-      SYSTEMUI_ERROR("Failed to play sound (%d, %s)", ca_error,
-                     ca_strerror(ca_error));
-#ifdef WITH_HILDON
-    banner =
-        hildon_banner_show_information(NULL, NULL,
-                                       dgettext("osso-powerup-shutdown",
-                                                "dpup_ia_thermal_shutdown"));
-    hildon_banner_set_timeout(HILDON_BANNER(banner), 9000);
-    gtk_widget_show_all(banner);
-    WindowPriority_ShowWindow(banner, 300u);
-#endif
-    thermal_shutdown_started = TRUE;
+static dbus_reply_context_t *reply_context = NULL;
+
+DBusMessageIter *
+systemui_reply_iter(system_ui_handler_arg *result)
+{
+  dbus_reply_context_t *ctx = reply_context;
+
+  if (!ctx || ctx->result != result)
+  {
+    SYSTEMUI_WARNING("No reply is being built for this result");
+    return NULL;
   }
+
+  if (!ctx->reply)
+  {
+    ctx->reply = dbus_message_new_method_return(ctx->msg);
+
+    if (!ctx->reply)
+      return NULL;
+
+    dbus_message_iter_init_append(ctx->reply, &ctx->iter);
+  }
+
+  return &ctx->iter;
 }
 
-static DBusHandlerResult
-dbus_req_handler(DBusConnection *connection, DBusMessage *msg, void *user_data)
+gboolean
+systemui_reply_append(system_ui_handler_arg *result, int first_arg_type, ...)
 {
-  system_ui_data *ui = user_data;
-  const gchar *dest = dbus_message_get_destination(msg);
-  const gchar *iface = dbus_message_get_interface(msg);
-  const gchar *method = dbus_message_get_member(msg);
-  const gchar *sender = dbus_message_get_sender(msg);
-  int msg_type = dbus_message_get_type(msg);
+  va_list ap;
+  dbus_bool_t rv;
 
-  if (!sender || !iface || !method)
-    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+  if (!systemui_reply_iter(result))
+    return FALSE;
 
-  if (msg_type == DBUS_MESSAGE_TYPE_METHOD_CALL && dest &&
-      !strcmp(dest, ui->bus_name))
+  va_start(ap, first_arg_type);
+  rv = dbus_message_append_args_valist(reply_context->reply, first_arg_type,
+                                       ap);
+  va_end(ap);
+
+  return rv;
+}
+
+int
+dbus_reply_string(system_ui_handler_arg *result, gchar *s)
+{
+  gboolean ok = systemui_reply_append(result, DBUS_TYPE_STRING, &s,
+                                      DBUS_TYPE_INVALID);
+
+  g_free(s);
+
+  return ok ? SYSTEMUI_REPLY_APPENDED : 0;
+}
+
+static gboolean
+dbus_iter_copy(DBusMessageIter *from, DBusMessageIter *to)
+{
+  int type;
+
+  while ((type = dbus_message_iter_get_arg_type(from)) != DBUS_TYPE_INVALID)
   {
-    GArray *args = g_array_new(FALSE, FALSE, sizeof(system_ui_handler_arg));
-    int type = 'm';
-    DBusMessageIter iter;
-    system_ui_handler_arg value;
+    if (dbus_type_is_basic(type))
+    {
+      DBusBasicValue value;
 
-    ULOG_INFO("Method call received from: %s, iface: %s, method: %s", sender,
-              iface, method);
+      dbus_message_iter_get_basic(from, &value);
 
-    if (dbus_message_iter_init(msg, &iter))
+      if (!dbus_message_iter_append_basic(to, type, &value))
+        return FALSE;
+    }
+    else
     {
-      while (1)
-      {
-        system_ui_handler_arg arg;
+      DBusMessageIter from_sub;
+      DBusMessageIter to_sub;
+      char *sig = NULL;
+      gboolean ok;
 
-        arg.arg_type = dbus_message_iter_get_arg_type(&iter);
-        dbus_message_iter_get_basic(&iter, &arg.data);
+      dbus_message_iter_recurse(from, &from_sub);
 
-        if (arg.arg_type == DBUS_TYPE_STRING)
-          arg.data.str = g_strdup(arg.data.str);
+      if (type == DBUS_TYPE_VARIANT)
+        sig = dbus_message_iter_get_signature(&from_sub);
+      else if (type == DBUS_TYPE_ARRAY)
+        sig = dbus_message_iter_get_signature(from);
 
-        g_array_append_vals(args, &arg, 1);
+      /* for arrays skip the leading 'a' to get the element signature */
+      ok = dbus_message_iter_open_container(
+            to, type, sig ? (type == DBUS_TYPE_ARRAY ? sig + 1 : sig) : NULL,
+            &to_sub);
+      dbus_free(sig);
 
-        if (!dbus_message_iter_has_next(&iter))
-          break;
+      if (!ok)
+        return FALSE;
 
-        dbus_message_iter_next(&iter);
+      if (!dbus_iter_copy(&from_sub, &to_sub))
+      {
+        dbus_message_iter_abandon_container(to, &to_sub);
+        return FALSE;
       }
+
+      if (!dbus_message_iter_close_container(to, &to_sub))
+        return FALSE;
     }
 
-    if (!g_ascii_strcasecmp(iface, ui->requestinterface))
+    dbus_message_iter_next(from);
+  }
+
+  return TRUE;
+}
+
+/* if the handler built the reply itself it is returned in reply, otherwise
+ * reply is set to NULL and value holds the result as before */
+static int
+dbus_call_handler(const char *iface, const char *method, GArray *args,
+                  system_ui_data *ui, system_ui_handler_arg *value,
+                  DBusMessage *msg, DBusMessage **reply)
+{
+  system_ui_handler handler = NULL;
+  gpointer key = NULL;
+  int type = 'm';
+
+  *reply = NULL;
+
+  if (g_tree_lookup_extended(ui->handlers, method, &key, (gpointer *)&handler))
+  {
+    /* a handler may remove itself, reloading idle plugins always does */
+    gchar *name = g_strdup(key);
+    gint64 start = g_get_monotonic_time();
+    gint64 cpu = wakeup_thread_cpu_time();
+    gint64 elapsed;
+    gpointer plugin = plugin_enter(method);
+    dbus_reply_context_t ctx = {value, msg, NULL};
+    dbus_reply_context_t *prev = reply_context;
+
+    reply_context = &ctx;
+    watchdog_enter("handler", name, plugin_get_name(plugin));
+    type = handler(iface, method, args, ui, value);
+    watchdog_leave();
+    reply_context = prev;
+    plugin_leave(plugin);
+
+    if (type == SYSTEMUI_REPLY_APPENDED)
+    {
+      /* nothing appended still means an empty method return */
+      *reply = ctx.reply ? ctx.reply : dbus_message_new_method_return(msg);
+    }
+    else if (ctx.reply)
+    {
+      SYSTEMUI_WARNING("Handler for '%s' returned '%c', discarding its "
+                       "appended reply", method, type ? type : '0');
+      dbus_message_unref(ctx.reply);
+    }
+
+    elapsed = g_get_monotonic_time() - start;
+    stats_method_call(name, TRUE, type, elapsed);
+    wakeup_handler_cpu(name, wakeup_thread_cpu_time() - cpu);
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_METHOD_DONE, method, type,
+                   elapsed, 0);
+    g_free(name);
+  }
+  else
+  {
+    SYSTEMUI_DEBUG("Unknown method call message");
+    stats_method_call(method, FALSE, type, 0);
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_UNKNOWN_METHOD, method, 0,
+                   0, 0);
+  }
+
+  return type;
+}
+
+/* a single appended value goes into the variant as is, several are wrapped
+ * in a struct, nothing at all becomes an int32 0 as for DBUS_TYPE_VARIANT */
+static gboolean
+dbus_batch_append_reply(DBusMessageIter *result, DBusMessage *reply)
+{
+  const char *sig = dbus_message_get_signature(reply);
+  gboolean single = dbus_signature_validate_single(sig, NULL);
+  gchar *var_sig;
+  DBusMessageIter var;
+  DBusMessageIter st;
+  DBusMessageIter from;
+  gboolean ok;
+
+  if (!*sig)
+  {
+    dbus_int32_t zero = 0;
+
+    return dbus_message_iter_open_container(result, DBUS_TYPE_VARIANT,
+                                            DBUS_TYPE_INT32_AS_STRING, &var) &&
+        dbus_message_iter_append_basic(&var, DBUS_TYPE_INT32, &zero) &&
+        dbus_message_iter_close_container(result, &var);
+  }
+
+  var_sig = single ? g_strdup(sig) : g_strdup_printf("(%s)", sig);
+  ok = dbus_message_iter_open_container(result, DBUS_TYPE_VARIANT, var_sig,
+                                        &var);
+  g_free(var_sig);
+
+  if (!ok)
+    return FALSE;
+
+  dbus_message_iter_init(reply, &from);
+
+  if (single)
+    ok = dbus_iter_copy(&from, &var);
+  else
+  {
+    ok = dbus_message_iter_open_container(&var, DBUS_TYPE_STRUCT, NULL, &st) &&
+        dbus_iter_copy(&from, &st) &&
+        dbus_message_iter_close_container(&var, &st);
+  }
+
+  return ok && dbus_message_iter_close_container(result, &var);
+}
+
+/* one (iv) per entry: the handler return type as with a plain call (0 for
+ * invalid arguments, 'm' for an unknown method) and its value */
+static gboolean
+dbus_batch_call_entry(DBusMessage *msg, DBusMessageIter *entry,
+                      DBusMessageIter *results, system_ui_data *ui)
+{
+  DBusMessage *appended = NULL;
+  DBusMessageIter fields;
+  DBusMessageIter variants;
+  DBusMessageIter result;
+  DBusMessageIter var;
+  GString *signature = g_string_new(NULL);
+  const char *method;
+  const char *expected;
+  GArray *args = g_array_new(FALSE, FALSE, sizeof(system_ui_handler_arg));
+  system_ui_handler_arg value;
+  dbus_int32_t zero = 0;
+  int type = 0;
+  char sig[2] = {0, 0};
+
+  dbus_message_iter_recurse(entry, &fields);
+  dbus_message_iter_get_basic(&fields, &method);
+  dbus_message_iter_next(&fields);
+  dbus_message_iter_recurse(&fields, &variants);
+
+  while (dbus_message_iter_get_arg_type(&variants) == DBUS_TYPE_VARIANT)
+  {
+    DBusMessageIter contents;
+    char *s;
+
+    dbus_message_iter_recurse(&variants, &contents);
+    s = dbus_message_iter_get_signature(&contents);
+    g_string_append(signature, s);
+    dbus_free(s);
+    dbus_iter_get_args(&contents, args);
+    dbus_message_iter_next(&variants);
+  }
+
+  expected = handler_get_signature(method);
+
+  if (!expected || !strcmp(expected, signature->str))
+  {
+    type = dbus_call_handler(ui->requestinterface, method, args, ui, &value,
+                             msg, &appended);
+  }
+  else
+    stats_bad_signature();
+
+  g_string_free(signature, TRUE);
+
+  if (!dbus_message_iter_open_container(results, DBUS_TYPE_STRUCT, NULL,
+                                        &result))
+  {
+    goto oom;
+  }
+
+  if (type == SYSTEMUI_REPLY_APPENDED)
+  {
+    if (!appended ||
+        !dbus_message_iter_append_basic(&result, DBUS_TYPE_INT32, &type) ||
+        !dbus_batch_append_reply(&result, appended))
     {
-      system_ui_handler handler = g_tree_lookup(ui->handlers, method);
+      goto oom;
+    }
+
+    dbus_message_unref(appended);
+    dbus_free_args(args);
+
+    return dbus_message_iter_close_container(results, &result);
+  }
+
+  sig[0] = type && type != 'm' && type != DBUS_TYPE_VARIANT ?
+        type : DBUS_TYPE_INT32;
+
+  if (!dbus_message_iter_append_basic(&result, DBUS_TYPE_INT32, &type) ||
+      !dbus_message_iter_open_container(&result, DBUS_TYPE_VARIANT, sig,
+                                        &var) ||
+      !dbus_message_iter_append_basic(&var, sig[0],
+                                      sig[0] == type ? (void *)&value.data :
+                                                       (void *)&zero) ||
+      !dbus_message_iter_close_container(&result, &var) ||
+      !dbus_message_iter_close_container(results, &result))
+  {
+    goto oom;
+  }
+
+  dbus_free_args(args);
+
+  return TRUE;
+
+oom:
+  if (appended)
+    dbus_message_unref(appended);
+
+  dbus_free_args(args);
+
+  return FALSE;
+}
+
+static void
+dbus_handle_batch(DBusConnection *connection, DBusMessage *msg,
+                  system_ui_data *ui)
+{
+  DBusMessageIter iter;
+  DBusMessageIter entries;
+  DBusMessageIter reply_iter;
+  DBusMessageIter results;
+  DBusMessage *reply;
+
+  /* the signature was checked by dbus_batch_admit() */
+  reply = dbus_message_new_method_return(msg);
+
+  if (!reply)
+    goto out;
+
+  dbus_message_iter_init(msg, &iter);
+  dbus_message_iter_recurse(&iter, &entries);
+  dbus_message_iter_init_append(reply, &reply_iter);
+
+  if (!dbus_message_iter_open_container(&reply_iter, DBUS_TYPE_ARRAY,
+                                        SYSTEMUI_BATCH_RESULT_SIGNATURE,
+                                        &results))
+  {
+    goto oom;
+  }
+
+  /* all in this main loop iteration, stacking changes land in one frame */
+  while (dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_STRUCT)
+  {
+    if (!dbus_batch_call_entry(msg, &entries, &results, ui))
+      goto oom;
+
+    dbus_message_iter_next(&entries);
+  }
+
+  if (!dbus_message_iter_close_container(&reply_iter, &results))
+    goto oom;
+
+  goto out;
+
+oom:
+  dbus_message_unref(reply);
+  reply = NULL;
+
+out:
+  if (dbus_message_get_no_reply(msg))
+  {
+    if (reply)
+      dbus_message_unref(reply);
+  }
+  else if (reply)
+    dbus_send_message(connection, reply);
+  else
+  {
+    SYSTEMUI_CRITICAL("Failed to create reply message");
+    stats_reply_failed();
+  }
+}
+
+static void
+dbus_handle_method_call(DBusConnection *connection, DBusMessage *msg,
+                        system_ui_data *ui)
+{
+  const gchar *iface = dbus_message_get_interface(msg);
+  const gchar *method = dbus_message_get_member(msg);
+  GArray *args;
+  int type = 'm';
+  DBusMessageIter iter;
+  system_ui_handler_arg value;
+  DBusMessage *reply;
+  DBusMessage *appended = NULL;
+
+  if (!g_ascii_strcasecmp(method, SYSTEMUI_BATCH_REQ))
+  {
+    dbus_handle_batch(connection, msg, ui);
+    return;
+  }
+
+  args = g_array_new(FALSE, FALSE, sizeof(system_ui_handler_arg));
+
+  if (dbus_message_iter_init(msg, &iter))
+    dbus_iter_get_args(&iter, args);
+
+  /* the filter already turned away other interfaces */
+  type = dbus_call_handler(iface, method, args, ui, &value, msg, &appended);
 
-      if (handler)
-        type = handler(iface, method, args, ui, &value);
+  dbus_free_args(args);
+
+  if (dbus_message_get_no_reply(msg))
+  {
+    if (appended)
+      dbus_message_unref(appended);
+  }
+  else if (type == SYSTEMUI_REPLY_APPENDED)
+  {
+    if (appended)
+    {
+      ratelimit_store_reply(msg, appended);
+      dbus_send_message(connection, appended);
+    }
+    else
+    {
+      SYSTEMUI_CRITICAL("Failed to create reply message");
+      stats_reply_failed();
+    }
+  }
+  else
+  {
+    if (type)
+    {
+      if (type == 'm')
+      {
+        reply = dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD,
+                                       "No such method");
+      }
       else
-        SYSTEMUI_INFO("Unknown method call message");
+        reply = dbus_message_new_method_return(msg);
     }
     else
-      SYSTEMUI_INFO("Invalid interface");
+    {
+      reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS,
+                                     DBUS_ERROR_INVALID_ARGS);
+    }
 
-    for (int i = 0; i < args->len; i++)
+    if (reply)
     {
-      system_ui_handler_arg *arg = &((system_ui_handler_arg *)args->data)[i];
+      dbus_message_iter_init_append(reply, &iter);
 
-      if (arg->arg_type == DBUS_TYPE_STRING)
-        g_free(arg->data.str);
+      if (type == DBUS_TYPE_VARIANT)
+      {
+        dbus_int32_t i = 0;
+
+        dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &i);
+      }
+      else if (type && type != 'm')
+        dbus_message_iter_append_basic(&iter, type, &value.data);
+
+      ratelimit_store_reply(msg, reply);
+      dbus_send_message(connection, reply);
+    }
+    else
+    {
+      SYSTEMUI_CRITICAL("Failed to create reply message");
+      stats_reply_failed();
     }
+  }
+}
 
-    g_array_free(args, TRUE);
+static void
+dbus_handle_signal(DBusConnection *connection, DBusMessage *msg,
+                   system_ui_data *ui)
+{
+  const gchar *iface = dbus_message_get_interface(msg);
+  const gchar *method = dbus_message_get_member(msg);
 
-    if (dbus_message_get_no_reply(msg) == FALSE)
+  stats_signal();
+  SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_SIGNAL, method, 0, 0, 0);
+
+  if (!strcmp(iface, LOCALE_CHANGED_INTERFACE) &&
+      !strcmp(method, LOCALE_CHANGED_SIG_NAME))
+  {
+    gchar *locale = NULL;
+
+    dbus_message_get_args(msg, NULL,
+                          DBUS_TYPE_STRING, &locale,
+                          DBUS_TYPE_INVALID);
+    i18n_locale_changed(ui, locale);
+  }
+  else if (dbus_message_is_signal(msg, THERMAL_MANAGER_IF,
+                                  THERMAL_STATE_CHANGE_SIG))
+  {
+    thermal_handle_signal(ui, msg);
+  }
+  else if(!strcmp(iface, "com.nokia.dsme.signal"))
+  {
+    if(!strcmp(method, "denied_req_ind"))
     {
-      DBusMessage *reply;
+      gchar *action = NULL;
+      gchar *reason = NULL;
+      gchar *ok_msg = "";
+      guint32 style = 0;
+      const char *message;
+
+      dbus_message_get_args(msg, NULL,
+                            DBUS_TYPE_STRING, &action,
+                            DBUS_TYPE_STRING, &reason,
+                            DBUS_TYPE_INVALID);
+
+      ULOG_INFO("Got DSME denied_req_ind signal, action='%s', reason='%s'",
+                action, reason);
 
-      if (type)
+      message = systemui_dgettext("osso-powerup-shutdown",
+                                  "powerup_in_do_not_switch_off");
+
+      msg = dbus_message_new_method_call("org.freedesktop.Notifications",
+                                         "/org/freedesktop/Notifications",
+                                         "org.freedesktop.Notifications",
+                                         "SystemNoteDialog");
+
+      if (msg)
       {
-        if (type == 'm')
+        if (dbus_message_append_args(msg,
+                                     DBUS_TYPE_STRING, &message,
+                                     DBUS_TYPE_UINT32, &style,
+                                     DBUS_TYPE_STRING, &ok_msg,
+                                     DBUS_TYPE_INVALID))
         {
-          reply = dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD,
-                                         "No such method");
+          dbus_send_message(session_bus, msg);
         }
         else
-          reply = dbus_message_new_method_return(msg);
+          SYSTEMUI_ERROR("Unable to add parameters to dbus call");
       }
       else
-      {
-        reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS,
-                                       DBUS_ERROR_INVALID_ARGS);
-      }
+        SYSTEMUI_CRITICAL("Unable to create dbus message to SystemNoteDialog");
+    }
+    else if(!strcmp(method, "shutdown_ind"))
+    {
+      ULOG_INFO("systemui: shutdown_ind from DSME, quitting");
+      gtk_main_quit();
+    }
+  }
+}
 
-      if (reply)
-      {
-        dbus_message_iter_init_append(reply, &iter);
+static void
+dbus_dispatch_message(DBusConnection *connection, DBusMessage *msg,
+                      system_ui_data *ui)
+{
+  if (dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_METHOD_CALL)
+  {
+    watchdog_enter("method", dbus_message_get_member(msg), NULL);
+    dbus_handle_method_call(connection, msg, ui);
+  }
+  else
+  {
+    watchdog_enter("signal", dbus_message_get_member(msg), NULL);
+    dbus_handle_signal(connection, msg, ui);
+  }
 
-        if (type == DBUS_TYPE_VARIANT)
-        {
-          dbus_int32_t i = 0;
+  watchdog_leave();
+}
 
-          dbus_message_iter_append_basic(&iter, DBUS_TYPE_INT32, &i);
-        }
-        else if (type && type != 'm')
-          dbus_message_iter_append_basic(&iter, type, &value.data);
+/* the highest class of the batched methods */
+static gint
+dbus_batch_priority_class(DBusMessage *msg)
+{
+  DBusMessageIter iter;
+  DBusMessageIter entries;
+  gint prio_class = 0;
 
-        dbus_send_message(connection, reply);
-      }
-      else
-        return DBUS_HANDLER_RESULT_NEED_MEMORY;
-    }
+  if (!dbus_message_has_signature(msg, SYSTEMUI_BATCH_SIGNATURE))
+    return 0;
 
-    return DBUS_HANDLER_RESULT_HANDLED;
+  dbus_message_iter_init(msg, &iter);
+  dbus_message_iter_recurse(&iter, &entries);
+
+  while (dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_STRUCT)
+  {
+    DBusMessageIter fields;
+    const char *method;
+
+    dbus_message_iter_recurse(&entries, &fields);
+    dbus_message_iter_get_basic(&fields, &method);
+    prio_class = MAX(prio_class, dispatch_member_class(method));
+    dbus_message_iter_next(&entries);
   }
-  else if (msg_type == DBUS_MESSAGE_TYPE_SIGNAL)
+
+  return prio_class;
+}
+
+/* a batch is no way around the limits, each entry is charged to its own
+ * method. FALSE if the batch was answered with an error instead */
+static gboolean
+dbus_batch_admit(DBusConnection *connection, DBusMessage *msg,
+                 system_ui_data *ui)
+{
+  DBusMessageIter iter;
+  DBusMessageIter entries;
+  DBusMessage *reply;
+  const char *error;
+  const char *text;
+  guint count = 0;
+
+  if (!dbus_message_has_signature(msg, SYSTEMUI_BATCH_SIGNATURE))
   {
+    stats_bad_signature();
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_BAD_SIGNATURE,
+                   SYSTEMUI_BATCH_REQ, dbus_message_get_serial(msg), 0, 0);
+    error = DBUS_ERROR_INVALID_ARGS;
+    text = "Expected signature '" SYSTEMUI_BATCH_SIGNATURE "'";
+    goto reject;
+  }
 
-    if (!strcmp(iface, LOCALE_CHANGED_INTERFACE) &&
-        !strcmp(method, LOCALE_CHANGED_SIG_NAME))
+  dbus_message_iter_init(msg, &iter);
+  dbus_message_iter_recurse(&iter, &entries);
+
+  /* counted first, an oversized batch must not use up tokens */
+  while (dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_STRUCT)
+  {
+    if (++count > SYSTEMUI_BATCH_MAX)
     {
-      gchar *locale = NULL;
+      error = DBUS_ERROR_LIMITS_EXCEEDED;
+      text = "Too many batch entries";
+      goto reject;
+    }
 
-      dbus_message_get_args(msg, NULL,
-                            DBUS_TYPE_STRING, &locale,
-                            DBUS_TYPE_INVALID);
-      ULOG_INFO("New locale: %s", locale);
+    dbus_message_iter_next(&entries);
+  }
+
+  dbus_message_iter_recurse(&iter, &entries);
+
+  while (dbus_message_iter_get_arg_type(&entries) == DBUS_TYPE_STRUCT)
+  {
+    DBusMessageIter fields;
+    const char *method;
+    const char *name;
 
-      if (locale)
-        setlocale(LC_MESSAGES, locale);
+    dbus_message_iter_recurse(&entries, &fields);
+    dbus_message_iter_get_basic(&fields, &method);
 
+    /* unknown methods are answered per entry and cost nothing */
+    if ((name = handler_get_name(ui, method)) && !ratelimit_charge(msg, name))
+    {
+      stats_rate_limited(FALSE);
+      SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_RATE_LIMITED, name,
+                     dbus_message_get_serial(msg), 0, 0);
+      error = DBUS_ERROR_LIMITS_EXCEEDED;
+      text = "Too many requests";
+      goto reject;
     }
-    else if(!strcmp(iface, "com.nokia.thermalmanager") &&
-            !strcmp(method, "thermal_state_change_ind"))
+
+    dbus_message_iter_next(&entries);
+  }
+
+  return TRUE;
+
+reject:
+  if (!dbus_message_get_no_reply(msg) &&
+      (reply = dbus_message_new_error(msg, error, text)))
+  {
+    dbus_send_message(connection, reply);
+  }
+
+  return FALSE;
+}
+
+static void
+dbus_reply_unknown_method(DBusConnection *connection, DBusMessage *msg)
+{
+  DBusMessage *reply;
+
+  if (!dbus_message_get_no_reply(msg) &&
+      (reply = dbus_message_new_error(msg, DBUS_ERROR_UNKNOWN_METHOD,
+                                      "No such method")))
+  {
+    dbus_send_message(connection, reply);
+  }
+}
+
+static DBusHandlerResult
+dbus_filter_message(DBusConnection *connection, DBusMessage *msg,
+                    system_ui_data *ui)
+{
+  const gchar *dest = dbus_message_get_destination(msg);
+  const gchar *iface = dbus_message_get_interface(msg);
+  const gchar *method = dbus_message_get_member(msg);
+  const gchar *sender = dbus_message_get_sender(msg);
+  int msg_type = dbus_message_get_type(msg);
+
+  if (!sender || !iface || !method)
+    return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+  if (msg_type == DBUS_MESSAGE_TYPE_SIGNAL)
+  {
+    capture_message(msg, connection == session_bus ? CAPTURE_BUS_SESSION :
+                                                     CAPTURE_BUS_SYSTEM);
+  }
+
+  if (msg_type == DBUS_MESSAGE_TYPE_METHOD_CALL && dest &&
+      !strcmp(dest, ui->bus_name))
+  {
+    DBusMessage *reply;
+    const char *name;
+    const char *signature;
+
+    capture_message(msg, connection == session_bus ? CAPTURE_BUS_SESSION :
+                                                     CAPTURE_BUS_SYSTEM);
+
+    SYSTEMUI_DEBUG("Method call received from: %s, iface: %s, method: %s",
+                   sender, iface, method);
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_METHOD_CALL, method,
+                   dbus_message_get_serial(msg), 0, 0);
+
+    /* cheap and must not wait behind queued requests */
+    if (ready_handle_properties(connection, msg, ui))
+      return DBUS_HANDLER_RESULT_HANDLED;
+
+    /* neither gets a rate limit bucket, they are answered right away */
+    if (g_ascii_strcasecmp(iface, ui->requestinterface))
     {
-      gchar *state = NULL;
+      SYSTEMUI_DEBUG("Invalid interface");
+      stats_invalid_interface();
+      SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_INVALID_IFACE, method, 0, 0,
+                     0);
+      dbus_reply_unknown_method(connection, msg);
 
-      dbus_message_get_args(msg, NULL,
-                            DBUS_TYPE_STRING, &state,
-                            DBUS_TYPE_INVALID);
-      handle_thermal_notification(ui, state);
+      return DBUS_HANDLER_RESULT_HANDLED;
     }
-    else if(!strcmp(iface, "com.nokia.dsme.signal"))
+
+    if (!g_ascii_strcasecmp(method, SYSTEMUI_BATCH_REQ))
     {
-      if(!strcmp(method, "denied_req_ind"))
+      if (dbus_batch_admit(connection, msg, ui))
       {
-        gchar *action = NULL;
-        gchar *reason = NULL;
-        gchar *ok_msg = "";
-        guint32 style = 0;
-        char *message;
+        dispatch_queue_message(connection, msg,
+                               dbus_batch_priority_class(msg));
+      }
 
-        dbus_message_get_args(msg, NULL,
-                              DBUS_TYPE_STRING, &action,
-                              DBUS_TYPE_STRING, &reason,
-                              DBUS_TYPE_INVALID);
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
 
-        ULOG_INFO("Got DSME denied_req_ind signal, action='%s', reason='%s'",
-                  action, reason);
+    /* dispatch ignores case, limits and stats go by the registered name */
+    if (!(name = handler_get_name(ui, method)))
+    {
+      SYSTEMUI_DEBUG("Unknown method call message");
+      stats_method_call(method, FALSE, 'm', 0);
+      SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_UNKNOWN_METHOD, method, 0,
+                     0, 0);
+      dbus_reply_unknown_method(connection, msg);
 
-        message = dgettext("osso-powerup-shutdown",
-                           "powerup_in_do_not_switch_off");
+      return DBUS_HANDLER_RESULT_HANDLED;
+    }
 
-        msg = dbus_message_new_method_call("org.freedesktop.Notifications",
-                                           "/org/freedesktop/Notifications",
-                                           "org.freedesktop.Notifications",
-                                           "SystemNoteDialog");
+    /* before rate limiting, that already allocates */
+    signature = handler_get_signature(method);
 
-        if (msg)
-        {
-          if (dbus_message_append_args(msg,
-                                       DBUS_TYPE_STRING, &message,
-                                       DBUS_TYPE_UINT32, &style,
-                                       DBUS_TYPE_STRING, &ok_msg,
-                                       DBUS_TYPE_INVALID))
-          {
-            dbus_send_message(session_bus, msg);
-          }
-          else
-            SYSTEMUI_ERROR("Unable to add parameters to dbus call");
-        }
-        else
-          SYSTEMUI_CRITICAL("Unable to create dbus message to SystemNoteDialog");
-      }
-      else if(!strcmp(method, "shutdown_ind"))
+    if (signature && !dbus_message_has_signature(msg, signature))
+    {
+      stats_bad_signature();
+      SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_BAD_SIGNATURE, method,
+                     dbus_message_get_serial(msg), 0, 0);
+
+      if (!dbus_message_get_no_reply(msg) &&
+          (reply = dbus_message_new_error_printf(
+             msg, DBUS_ERROR_INVALID_ARGS, "Expected signature '%s'",
+             signature)))
       {
-        ULOG_INFO("systemui: shutdown_ind from DSME, quitting");
-        gtk_main_quit();
+        dbus_send_message(connection, reply);
       }
+
+      return DBUS_HANDLER_RESULT_HANDLED;
     }
+
+    switch (ratelimit_check(msg, name, &reply))
+    {
+      case RATELIMIT_PASS:
+        break;
+      case RATELIMIT_COALESCED:
+        stats_rate_limited(TRUE);
+        SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_COALESCED, method,
+                       dbus_message_get_serial(msg), 0, 0);
+
+        if (reply)
+          dbus_send_message(connection, reply);
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+      case RATELIMIT_REJECT:
+        stats_rate_limited(FALSE);
+        SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_RATE_LIMITED, method,
+                       dbus_message_get_serial(msg), 0, 0);
+
+        if (!dbus_message_get_no_reply(msg) &&
+            (reply = dbus_message_new_error(msg, DBUS_ERROR_LIMITS_EXCEEDED,
+                                            "Too many requests")))
+        {
+          dbus_send_message(connection, reply);
+        }
+
+        return DBUS_HANDLER_RESULT_HANDLED;
+    }
+
+    dispatch_queue_message(connection, msg, dispatch_priority_class(msg));
+
+    return DBUS_HANDLER_RESULT_HANDLED;
   }
+  else if (msg_type == DBUS_MESSAGE_TYPE_SIGNAL)
+    dispatch_queue_message(connection, msg, dispatch_priority_class(msg));
 
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
+/* the watchdog charges stalls to what is marked here */
+static DBusHandlerResult
+dbus_req_handler(DBusConnection *connection, DBusMessage *msg, void *user_data)
+{
+  DBusHandlerResult rv;
+
+  watchdog_enter(dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_SIGNAL ?
+                   "signal" : "method",
+                 dbus_message_get_member(msg), NULL);
+  rv = dbus_filter_message(connection, msg, user_data);
+  watchdog_leave();
+
+  return rv;
+}
+
 static int
 quit_handler(const char *interface, const char *method, GArray *args,
                  system_ui_data *ui, system_ui_handler_arg *result)
@@ -323,6 +998,8 @@ quit_handler(const char *interface, const char *method, GArray *args,
 gboolean
 dbus_init(system_ui_data *ui)
 {
+  int fd;
+
   ui->mainloop = g_main_loop_new(0, 0);
   dbus_error_init(&ui->dbuserror);
   ui->system_bus = dbus_bus_get(DBUS_BUS_SYSTEM, &ui->dbuserror);
@@ -403,6 +1080,12 @@ dbus_init(system_ui_data *ui)
 
   dbus_connection_setup_with_g_main(ui->system_bus, NULL);
   dbus_connection_setup_with_g_main(session_bus, NULL);
+
+  if (dbus_connection_get_unix_fd(ui->system_bus, &fd))
+    wakeup_watch_fd(fd, "system_bus");
+
+  if (dbus_connection_get_unix_fd(session_bus, &fd))
+    wakeup_watch_fd(fd, "session_bus");
   dbus_connection_set_exit_on_disconnect(session_bus, TRUE);
 
   if (dbus_bus_request_name(ui->system_bus, ui->bus_name,
@@ -410,7 +1093,31 @@ dbus_init(system_ui_data *ui)
       DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER)
   {
       ui->handlers = NULL;
+      ready_reached(ui, READY_STAGE_BUS_NAME);
       systemui_add_handler(SYSTEMUI_QUIT_REQ, quit_handler, ui);
+
+      if (!stats_init(ui))
+        SYSTEMUI_WARNING("Failed to register statistics handlers");
+
+      if (!trace_init(ui))
+        SYSTEMUI_WARNING("Failed to register trace handlers");
+
+      if (!i18n_handler_init(ui))
+        SYSTEMUI_WARNING("Failed to register locale handler");
+
+      if (!wakeup_init(ui))
+        SYSTEMUI_WARNING("Failed to register wakeup report handler");
+
+      /* wraps the poll function wakeup_init() installed */
+      if (!watchdog_init(ui))
+        SYSTEMUI_WARNING("Failed to register watchdog handler");
+
+      ratelimit_init(ui);
+      dispatch_init(ui, dbus_dispatch_message);
+
+      if (!ready_init(ui))
+        SYSTEMUI_WARNING("Failed to register readiness handler");
+
       return TRUE;
   }
 
@@ -425,6 +1132,15 @@ dbus_finish(system_ui_data *ui)
 {
   DBusError *error = &ui->dbuserror;
 
+  signals_finish(ui);
+  ready_finish(ui);
+  dispatch_finish(ui);
+  ratelimit_finish(ui);
+  watchdog_finish(ui);
+  wakeup_finish(ui);
+  trace_finish(ui);
+  i18n_handler_finish(ui);
+  stats_finish(ui);
   systemui_remove_handler(SYSTEMUI_QUIT_REQ, ui);
 
   dbus_bus_remove_match(ui->system_bus,
@@ -468,20 +1184,3 @@ dbus_finish(system_ui_data *ui)
 
   return TRUE;
 }
-
-gboolean
-init_thermal_message_rcvr(system_ui_data *ui)
-{
-  dbus_bus_add_match(ui->system_bus,
-                     "type='signal',interface='com.nokia.thermalmanager',member='thermal_state_change_ind'",
-                     &ui->dbuserror);
-
-  if (dbus_error_is_set(&ui->dbuserror))
-  {
-    ULOG_WARN("Failed to add match for thermal notifications");
-    dbus_error_free(&ui->dbuserror);
-    return FALSE;
-  }
-
-  return TRUE;
-}
@@ -1,9 +1,36 @@
 #ifndef SYSTEMUI_DBUS_H
 #define SYSTEMUI_DBUS_H
 
+/* a(sav) of (method, arguments) in, a(iv) of (return type, value) out */
+#define SYSTEMUI_BATCH_REQ "batch"
+#define SYSTEMUI_BATCH_SIGNATURE "a(sav)"
+#define SYSTEMUI_BATCH_RESULT_SIGNATURE "(iv)"
+/* larger batches are refused with LimitsExceeded */
+#define SYSTEMUI_BATCH_MAX 32
+
+/* what system_ui_handler_arg.data points to for container types */
+struct system_ui_container_arg
+{
+  DBusMessageIter sub;
+  int element_type;
+};
+typedef struct system_ui_container_arg system_ui_container_arg_t;
+
+void dbus_iter_get_args(DBusMessageIter *iter, GArray *args);
+void dbus_free_args(GArray *args);
+
 gboolean dbus_send_message(DBusConnection *dbus, DBusMessage *msg);
-gboolean init_thermal_message_rcvr(system_ui_data *app_ui_data);
+/* for handlers answering with a string they built: appends it to the reply
+ * right away and frees it, returns what the handler has to */
+int dbus_reply_string(system_ui_handler_arg *result, gchar *s);
 gboolean dbus_init(system_ui_data *ui);
 gboolean dbus_finish(system_ui_data *ui);
 
+/* systemui.c */
+/* the name handler was registered with, lookups ignore case so anything keyed
+ * by method name has to use this one. NULL if there is no such handler */
+const char *handler_get_name(system_ui_data *ui, const char *name);
+const char *handler_get_signature(const char *name);
+void handler_set_signature(const char *name, const char *signature);
+
 #endif // SYSTEMUI_DBUS_H
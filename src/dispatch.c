@@ -0,0 +1,274 @@
+#include <string.h>
+#include <systemui.h>
+
+#include "dispatch.h"
+#include "settings.h"
+#include "stats.h"
+
+struct dispatch_entry
+{
+  DBusConnection *connection;
+  DBusMessage *msg;
+  gint prio_class;
+  gint64 queued;
+};
+typedef struct dispatch_entry dispatch_entry_t;
+
+struct dispatch_queue
+{
+  GSource source;
+  GQueue entries;
+};
+typedef struct dispatch_queue dispatch_queue_t;
+
+struct dispatch_class
+{
+  const char *member;
+  const char *prio_name;
+};
+
+/* plugins may override or extend that with systemui_set_handler_priority() */
+static const struct dispatch_class default_classes[] =
+{
+  {"thermal_state_change_ind", "ThermalShutdownNote"},
+  {"tklock_open", "TouchScreenLock"},
+  {"tklock_close", "TouchScreenLock"},
+  {"alarm_open", "AlarmDialog"},
+  {"alarm_close", "AlarmDialog"},
+  {"splashscreen_open", "NokiaLogoSplash"},
+  {"splashscreen_close", "NokiaLogoSplash"},
+  {"powerkey_menu_open", "PowerKeyMenu"},
+  {"powerkey_menu_close", "PowerKeyMenu"},
+  {"shutdown_ind", "SwitchOffNote"},
+  {"denied_req_ind", "SwitchOffNote"},
+  {"devlock_open", "DeviceLock"},
+  {"devlock_close", "DeviceLock"},
+  {"modechange_open", "ModeChangeDialog"},
+  {"modechange_close", "ModeChangeDialog"},
+  {"acting_dead_open", "ActingDeadScreen"},
+  {"acting_dead_close", "ActingDeadScreen"}
+};
+
+static system_ui_data *dispatch_ui = NULL;
+static dispatch_func dispatch_cb = NULL;
+
+/* member -> priority class */
+static GHashTable *classes = NULL;
+static gint critical_class = G_MAXINT;
+
+static dispatch_queue_t *critical_queue = NULL;
+static dispatch_queue_t *normal_queue = NULL;
+
+static void
+dispatch_entry_free(dispatch_entry_t *entry)
+{
+  dbus_message_unref(entry->msg);
+  dbus_connection_unref(entry->connection);
+  g_slice_free(dispatch_entry_t, entry);
+}
+
+static gboolean
+dispatch_queue_prepare(GSource *source, gint *timeout)
+{
+  *timeout = -1;
+
+  return !g_queue_is_empty(&((dispatch_queue_t *)source)->entries);
+}
+
+static gboolean
+dispatch_queue_check(GSource *source)
+{
+  return !g_queue_is_empty(&((dispatch_queue_t *)source)->entries);
+}
+
+/* one message per iteration, so redraws and new arrivals get a chance */
+static gboolean
+dispatch_queue_dispatch(GSource *source, GSourceFunc callback,
+                        gpointer user_data)
+{
+  dispatch_queue_t *queue = (dispatch_queue_t *)source;
+  dispatch_entry_t *entry = g_queue_pop_head(&queue->entries);
+
+  if (entry)
+  {
+    stats_dispatch_wait(g_get_monotonic_time() - entry->queued);
+    dispatch_cb(entry->connection, entry->msg, dispatch_ui);
+    dispatch_entry_free(entry);
+  }
+
+  return TRUE;
+}
+
+static void
+dispatch_queue_finalize(GSource *source)
+{
+  dispatch_queue_t *queue = (dispatch_queue_t *)source;
+  dispatch_entry_t *entry;
+
+  while ((entry = g_queue_pop_head(&queue->entries)))
+    dispatch_entry_free(entry);
+}
+
+static GSourceFuncs dispatch_queue_funcs =
+{
+  dispatch_queue_prepare,
+  dispatch_queue_check,
+  dispatch_queue_dispatch,
+  dispatch_queue_finalize
+};
+
+static dispatch_queue_t *
+dispatch_queue_new(gint priority)
+{
+  GSource *source = g_source_new(&dispatch_queue_funcs,
+                                 sizeof(dispatch_queue_t));
+
+  g_queue_init(&((dispatch_queue_t *)source)->entries);
+  g_source_set_priority(source, priority);
+  g_source_attach(source, NULL);
+
+  return (dispatch_queue_t *)source;
+}
+
+gint
+dispatch_get_priority(void)
+{
+  return critical_queue ? g_source_get_priority(&critical_queue->source) :
+                          G_PRIORITY_HIGH;
+}
+
+gint
+dispatch_member_class(const char *member)
+{
+  gpointer prio;
+
+  if (member && classes &&
+      g_hash_table_lookup_extended(classes, member, NULL, &prio))
+  {
+    return GPOINTER_TO_INT(prio);
+  }
+
+  return 0;
+}
+
+gboolean
+dispatch_class_is_critical(gint prio_class)
+{
+  return prio_class >= critical_class;
+}
+
+gint
+dispatch_priority_class(DBusMessage *msg)
+{
+  return dispatch_member_class(dbus_message_get_member(msg));
+}
+
+void
+dispatch_queue_message(DBusConnection *connection, DBusMessage *msg,
+                       gint prio_class)
+{
+  dispatch_queue_t *queue;
+  dispatch_entry_t *entry;
+  GList *l;
+
+  g_return_if_fail(normal_queue != NULL);
+
+  queue = dispatch_class_is_critical(prio_class) ? critical_queue :
+                                                  normal_queue;
+
+  entry = g_slice_new(dispatch_entry_t);
+  entry->connection = dbus_connection_ref(connection);
+  entry->msg = dbus_message_ref(msg);
+  entry->prio_class = prio_class;
+  entry->queued = g_get_monotonic_time();
+
+  /* highest class first, FIFO within a class. Searching from the tail as most
+   * of the time the queue is either empty or all of the same class */
+  for (l = queue->entries.tail; l; l = l->prev)
+  {
+    if (((dispatch_entry_t *)l->data)->prio_class >= prio_class)
+      break;
+  }
+
+  if (l)
+    g_queue_insert_after(&queue->entries, l, entry);
+  else
+    g_queue_push_head(&queue->entries, entry);
+
+  stats_dispatch_queued(g_queue_get_length(&critical_queue->entries) +
+                        g_queue_get_length(&normal_queue->entries));
+}
+
+gboolean
+systemui_set_handler_priority(const char *name, unsigned int priority,
+                              system_ui_data *ui)
+{
+  g_return_val_if_fail(classes != NULL, FALSE);
+
+  g_hash_table_replace(classes, g_strdup(name), GINT_TO_POINTER(priority));
+
+  return TRUE;
+}
+
+gboolean
+dispatch_init(system_ui_data *ui, dispatch_func func)
+{
+  gint priority;
+  int i;
+
+  dispatch_ui = ui;
+  dispatch_cb = func;
+
+  classes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS(default_classes); i++)
+  {
+    gint prio = hsl_prio_by_name(default_classes[i].prio_name);
+
+    if (prio >= 0)
+    {
+      g_hash_table_insert(classes, g_strdup(default_classes[i].member),
+                          GINT_TO_POINTER(prio));
+    }
+  }
+
+  critical_class = hsl_prio_by_name(DISPATCH_CRITICAL_CLASS_NAME);
+
+  if (critical_class < 0)
+    critical_class = G_MAXINT;
+
+  priority = settings_get_int(ui, SYSTEMUI_GCONF_DISPATCH_PRIORITY,
+                              G_PRIORITY_DEFAULT);
+
+  critical_queue = dispatch_queue_new(MIN(priority, G_PRIORITY_HIGH));
+  normal_queue = dispatch_queue_new(priority);
+
+  return TRUE;
+}
+
+void
+dispatch_finish(system_ui_data *ui)
+{
+  if (normal_queue)
+  {
+    g_source_destroy(&normal_queue->source);
+    g_source_unref(&normal_queue->source);
+    normal_queue = NULL;
+  }
+
+  if (critical_queue)
+  {
+    g_source_destroy(&critical_queue->source);
+    g_source_unref(&critical_queue->source);
+    critical_queue = NULL;
+  }
+
+  if (classes)
+  {
+    g_hash_table_destroy(classes);
+    classes = NULL;
+  }
+
+  dispatch_cb = NULL;
+  dispatch_ui = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef SYSTEMUI_DISPATCH_H
+#define SYSTEMUI_DISPATCH_H
+
+/* main loop priority for requests below DISPATCH_CRITICAL_CLASS, GDK redraws
+ * run at GDK_PRIORITY_REDRAW (G_PRIORITY_HIGH_IDLE + 20) */
+#define SYSTEMUI_GCONF_DISPATCH_PRIORITY SYSTEMUI_GCONF_DIR "dispatch_priority"
+
+/* classes at or above TouchScreenLock are dispatched at G_PRIORITY_HIGH */
+#define DISPATCH_CRITICAL_CLASS_NAME "TouchScreenLock"
+
+typedef void (*dispatch_func)(DBusConnection *connection, DBusMessage *msg,
+                              system_ui_data *ui);
+
+/* main loop priority of critical requests, nothing dispatched is above it */
+gint dispatch_get_priority(void);
+gint dispatch_member_class(const char *member);
+gint dispatch_priority_class(DBusMessage *msg);
+/* TRUE at or above DISPATCH_CRITICAL_CLASS_NAME */
+gboolean dispatch_class_is_critical(gint prio_class);
+void dispatch_queue_message(DBusConnection *connection, DBusMessage *msg,
+                            gint prio_class);
+
+gboolean dispatch_init(system_ui_data *ui, dispatch_func func);
+void dispatch_finish(system_ui_data *ui);
+
+/* systemui.c */
+gint hsl_prio_by_name(const char *name);
+/* NULL if prio is not a named class */
+const char *hsl_name_by_prio(guint prio);
+
+#endif // SYSTEMUI_DISPATCH_H
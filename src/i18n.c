@@ -0,0 +1,158 @@
+#include <locale.h>
+#include <libintl.h>
+#include <string.h>
+#include <osso-log.h>
+#include <systemui.h>
+
+#include "config.h"
+#include "i18n.h"
+#include "plugin.h"
+#include "watch-list.h"
+
+/* domain -> directory, rebound on every change */
+static GHashTable *domains = NULL;
+/* "domain\004msgid" -> translation */
+static GHashTable *translations = NULL;
+static watch_list_t watches = WATCH_LIST_INIT(NULL);
+
+void
+systemui_bind_textdomain(const char *domain, const char *dir)
+{
+  g_return_if_fail(domain != NULL);
+
+  bindtextdomain(domain, dir);
+  bind_textdomain_codeset(domain, "UTF-8");
+
+  if (domains)
+    g_hash_table_replace(domains, g_strdup(domain), g_strdup(dir));
+}
+
+const char *
+systemui_dgettext(const char *domain, const char *msgid)
+{
+  gchar *key;
+  const char *rv;
+
+  if (!translations)
+    return dgettext(domain, msgid);
+
+  key = g_strconcat(domain ? domain : "", "\004", msgid, NULL);
+  rv = g_hash_table_lookup(translations, key);
+
+  if (!rv)
+  {
+    rv = g_strdup(dgettext(domain, msgid));
+    g_hash_table_insert(translations, key, (gpointer)rv);
+  }
+  else
+    g_free(key);
+
+  return rv;
+}
+
+guint
+systemui_locale_notify_add(systemui_locale_changed_func func,
+                           gpointer user_data)
+{
+  return watch_list_add(&watches, G_CALLBACK(func), NULL, user_data);
+}
+
+void
+systemui_locale_notify_remove(guint id)
+{
+  watch_list_remove(&watches, id);
+}
+
+typedef struct
+{
+  system_ui_data *ui;
+  const char *locale;
+} locale_change_t;
+
+static void
+i18n_watch_call(watch_t *w, gpointer call_data)
+{
+  locale_change_t *change = call_data;
+
+  ((systemui_locale_changed_func)w->func)(change->ui, change->locale,
+                                          w->user_data);
+}
+
+static void
+i18n_rebind(gpointer domain, gpointer dir, gpointer user_data)
+{
+  bindtextdomain(domain, dir);
+}
+
+void
+i18n_locale_changed(system_ui_data *ui, const char *locale)
+{
+  locale_change_t change = {ui, locale};
+
+  if (!locale || !*locale)
+    return;
+
+  ULOG_INFO("New locale: %s", locale);
+
+  /* no setenv(), the watchdog and D-Bus threads may read the environment
+   * at any time. A LANGUAGE set at startup still wins over the new locale */
+  if (!setlocale(LC_MESSAGES, locale))
+    SYSTEMUI_WARNING("Locale '%s' is not available", locale);
+
+  /* setting the domain again invalidates gettext's own catalog cache */
+  g_hash_table_foreach(domains, i18n_rebind, NULL);
+  textdomain(TEXT_DOMAIN);
+  g_hash_table_remove_all(translations);
+
+  plugin_notify_locale_changed(locale);
+  watch_list_call(&watches, i18n_watch_call, &change);
+}
+
+static int
+i18n_locale_handler(const char *interface, const char *method, GArray *args,
+                    system_ui_data *ui, system_ui_handler_arg *result)
+{
+  system_ui_handler_arg *arg = (system_ui_handler_arg *)args->data;
+
+  if (!arg->data.str || !*arg->data.str)
+    return 0;
+
+  i18n_locale_changed(ui, arg->data.str);
+
+  return DBUS_TYPE_VARIANT;
+}
+
+void
+i18n_init(system_ui_data *ui)
+{
+  domains = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  translations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       g_free);
+
+  systemui_bind_textdomain(TEXT_DOMAIN, "/usr/share/locale");
+  textdomain(TEXT_DOMAIN);
+}
+
+gboolean
+i18n_handler_init(system_ui_data *ui)
+{
+  return systemui_add_handler_with_signature(SYSTEMUI_LOCALE_REQ,
+                                             i18n_locale_handler, "s", ui);
+}
+
+void
+i18n_handler_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_LOCALE_REQ, ui);
+}
+
+void
+i18n_finish(system_ui_data *ui)
+{
+  watch_list_clear(&watches);
+
+  g_hash_table_destroy(translations);
+  translations = NULL;
+  g_hash_table_destroy(domains);
+  domains = NULL;
+}
@@ -0,0 +1,17 @@
+#ifndef SYSTEMUI_I18N_H
+#define SYSTEMUI_I18N_H
+
+/* takes the new locale, for the session scripts. Only systemui switches,
+ * unlike with a locale_changed broadcast */
+#define SYSTEMUI_LOCALE_REQ "set_locale"
+
+void i18n_init(system_ui_data *ui);
+/* registers SYSTEMUI_LOCALE_REQ, once the handlers exist */
+gboolean i18n_handler_init(system_ui_data *ui);
+void i18n_handler_finish(system_ui_data *ui);
+/* switches LC_MESSAGES to locale and tells everyone about it, the
+ * environment is left alone */
+void i18n_locale_changed(system_ui_data *ui, const char *locale);
+void i18n_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_I18N_H
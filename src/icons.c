@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <string.h>
+#include <systemui.h>
+
+#include "icons.h"
+#include "ipm.h"
+#include "settings.h"
+
+#define ICONS_DEFAULT_CACHE_KIB 2048
+
+struct icon_entry
+{
+  gchar *key;
+  GdkPixbuf *pixbuf;
+  gsize bytes;
+  GList *lru;
+};
+typedef struct icon_entry icon_entry_t;
+
+struct icon_request
+{
+  gchar *name;
+  gint size;
+};
+typedef struct icon_request icon_request_t;
+
+/* "size:name" -> icon_entry_t */
+static GHashTable *cache = NULL;
+/* most recently used first */
+static GQueue lru = G_QUEUE_INIT;
+static gsize cache_bytes = 0;
+static gsize cache_max = ICONS_DEFAULT_CACHE_KIB * 1024;
+
+static GQueue prewarm = G_QUEUE_INIT;
+static guint prewarm_id = 0;
+
+static gulong theme_changed_id = 0;
+
+static struct
+{
+  guint hits;
+  guint misses;
+  guint failures;
+  guint evictions;
+} stats;
+
+static void
+icon_entry_free(icon_entry_t *entry)
+{
+  g_object_unref(entry->pixbuf);
+  g_free(entry->key);
+  g_free(entry);
+}
+
+static void
+icons_remove(icon_entry_t *entry)
+{
+  g_queue_delete_link(&lru, entry->lru);
+  cache_bytes -= entry->bytes;
+  g_hash_table_remove(cache, entry->key);
+}
+
+static void
+icons_clear(void)
+{
+  while (!g_queue_is_empty(&lru))
+    icons_remove(g_queue_peek_tail(&lru));
+}
+
+static void
+icons_theme_changed(GtkIconTheme *theme, gpointer user_data)
+{
+  icons_clear();
+}
+
+GtkIconTheme *
+systemui_get_icon_theme(system_ui_data *ui)
+{
+  /* there is no screen to get one for */
+  if (!ui->icontheme && !ipm_headless())
+  {
+    ui->icontheme = gtk_icon_theme_get_default();
+    theme_changed_id = g_signal_connect(ui->icontheme, "changed",
+                                        G_CALLBACK(icons_theme_changed),
+                                        NULL);
+  }
+
+  return ui->icontheme;
+}
+
+static GdkPixbuf *
+icons_decode(system_ui_data *ui, const char *name, gint size)
+{
+  GtkIconTheme *theme;
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
+
+  if (name[0] == '/')
+    pixbuf = gdk_pixbuf_new_from_file_at_size(name, size, size, &error);
+  else if ((theme = systemui_get_icon_theme(ui)))
+    pixbuf = gtk_icon_theme_load_icon(theme, name, size, 0, &error);
+  else
+    return NULL;
+
+  if (!pixbuf)
+  {
+    SYSTEMUI_DEBUG("Cannot load icon '%s' at %d: %s", name, size,
+                   error ? error->message : "unknown error");
+  }
+
+  if (error)
+    g_error_free(error);
+
+  return pixbuf;
+}
+
+GdkPixbuf *
+systemui_icon_cache_load(system_ui_data *ui, const char *name, gint size)
+{
+  icon_entry_t *entry;
+  GdkPixbuf *pixbuf;
+  gchar *key;
+  gsize bytes;
+
+  g_return_val_if_fail(name != NULL, NULL);
+
+  if (!cache)
+    return icons_decode(ui, name, size);
+
+  key = g_strdup_printf("%d:%s", size, name);
+
+  if ((entry = g_hash_table_lookup(cache, key)))
+  {
+    g_free(key);
+    stats.hits++;
+    g_queue_unlink(&lru, entry->lru);
+    g_queue_push_head_link(&lru, entry->lru);
+
+    return g_object_ref(entry->pixbuf);
+  }
+
+  stats.misses++;
+
+  if (!(pixbuf = icons_decode(ui, name, size)))
+  {
+    g_free(key);
+    stats.failures++;
+
+    return NULL;
+  }
+
+  bytes = (gsize)gdk_pixbuf_get_rowstride(pixbuf) *
+      gdk_pixbuf_get_height(pixbuf);
+
+  /* would evict everything else */
+  if (bytes > cache_max)
+  {
+    g_free(key);
+
+    return pixbuf;
+  }
+
+  while (cache_bytes + bytes > cache_max && !g_queue_is_empty(&lru))
+  {
+    icons_remove(g_queue_peek_tail(&lru));
+    stats.evictions++;
+  }
+
+  entry = g_new(icon_entry_t, 1);
+  entry->key = key;
+  entry->pixbuf = g_object_ref(pixbuf);
+  entry->bytes = bytes;
+  g_queue_push_head(&lru, entry);
+  entry->lru = g_queue_peek_head_link(&lru);
+  cache_bytes += bytes;
+  g_hash_table_insert(cache, key, entry);
+
+  return pixbuf;
+}
+
+/* one icon per main loop iteration, requests must not wait behind all */
+static gboolean
+icons_prewarm_one(gpointer user_data)
+{
+  icon_request_t *req = g_queue_pop_head(&prewarm);
+  GdkPixbuf *pixbuf;
+
+  if (req)
+  {
+    if ((pixbuf = systemui_icon_cache_load(user_data, req->name, req->size)))
+      g_object_unref(pixbuf);
+
+    g_free(req->name);
+    g_free(req);
+  }
+
+  if (g_queue_is_empty(&prewarm))
+  {
+    prewarm_id = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+icons_prewarm_add(system_ui_data *ui, const char *name, gint size)
+{
+  icon_request_t *req = g_new(icon_request_t, 1);
+
+  req->name = g_strdup(name);
+  req->size = size;
+  g_queue_push_tail(&prewarm, req);
+
+  if (!prewarm_id)
+  {
+    prewarm_id = g_idle_add_full(G_PRIORITY_LOW, icons_prewarm_one, ui,
+                                 NULL);
+  }
+}
+
+void
+systemui_icon_cache_prewarm(system_ui_data *ui, const char *const *names,
+                            gint size)
+{
+  if (!cache || !names)
+    return;
+
+  for (; *names; names++)
+    icons_prewarm_add(ui, *names, size);
+}
+
+void
+icons_print_stats(GString *s)
+{
+  g_string_append_printf(
+        s, "icons cached=%u bytes=%lu max_bytes=%lu hits=%u misses=%u "
+        "failures=%u evictions=%u\n", g_queue_get_length(&lru),
+        (unsigned long)cache_bytes, (unsigned long)cache_max, stats.hits,
+        stats.misses, stats.failures, stats.evictions);
+}
+
+void
+icons_reset_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+gboolean
+icons_init(system_ui_data *ui)
+{
+  gint kib = settings_get_int(ui, SYSTEMUI_GCONF_ICON_CACHE_SIZE,
+                              ICONS_DEFAULT_CACHE_KIB);
+  gchar *list;
+
+  ui->icontheme = NULL;
+
+  if (kib <= 0)
+    return TRUE;
+
+  cache_max = (gsize)kib * 1024;
+  cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                (GDestroyNotify)icon_entry_free);
+
+  if ((list = settings_get_string(ui, SYSTEMUI_GCONF_ICON_PREWARM)))
+  {
+    gchar **icons = g_strsplit(list, ",", -1);
+    gchar **icon;
+
+    for (icon = icons; *icon; icon++)
+    {
+      gchar *sep = strrchr(g_strstrip(*icon), ':');
+
+      if (!sep || sep == *icon)
+      {
+        SYSTEMUI_WARNING("Invalid prewarm entry '%s'", *icon);
+        continue;
+      }
+
+      *sep = 0;
+      icons_prewarm_add(ui, *icon, atoi(sep + 1));
+    }
+
+    g_strfreev(icons);
+    g_free(list);
+  }
+
+  return TRUE;
+}
+
+void
+icons_finish(system_ui_data *ui)
+{
+  icon_request_t *req;
+
+  if (prewarm_id)
+  {
+    g_source_remove(prewarm_id);
+    prewarm_id = 0;
+  }
+
+  while ((req = g_queue_pop_head(&prewarm)))
+  {
+    g_free(req->name);
+    g_free(req);
+  }
+
+  if (cache)
+  {
+    icons_clear();
+    g_hash_table_destroy(cache);
+    cache = NULL;
+  }
+
+  if (theme_changed_id)
+  {
+    g_signal_handler_disconnect(ui->icontheme, theme_changed_id);
+    theme_changed_id = 0;
+  }
+
+  ui->icontheme = NULL;
+}
@@ -0,0 +1,15 @@
+#ifndef SYSTEMUI_ICONS_H
+#define SYSTEMUI_ICONS_H
+
+/* memory cap of the shared pixbuf cache in KiB, 0 disables caching */
+#define SYSTEMUI_GCONF_ICON_CACHE_SIZE SYSTEMUI_GCONF_DIR "icon_cache_kib"
+/* "name:size,..." decoded at idle priority after startup */
+#define SYSTEMUI_GCONF_ICON_PREWARM SYSTEMUI_GCONF_DIR "icon_prewarm"
+
+void icons_print_stats(GString *s);
+void icons_reset_stats(void);
+
+gboolean icons_init(system_ui_data *ui);
+void icons_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_ICONS_H
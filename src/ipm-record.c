@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+#include <osso-log.h>
+#include <systemui.h>
+
+#include "config.h"
+#include "dbus.h"
+#include "ipm.h"
+
+typedef enum
+{
+  IPM_OP_SHOW,
+  IPM_OP_HIDE
+} ipm_op_t;
+
+static const char *op_names[] =
+{
+  "show",
+  "hide"
+};
+
+typedef struct
+{
+  gint64 timestamp; /* monotonic, usecs */
+  ipm_op_t op;
+  guint priority;
+  gint layer;       /* -1 for none */
+  gpointer widget;
+  guint depth;      /* window priority list length after the op */
+} ipm_record_t;
+
+static GArray *records = NULL;
+static guint dropped = 0;
+static gint64 start_time = 0;
+static gchar *record_file = NULL;
+
+static void
+ipm_record_add(ipm_op_t op, GtkWidget *widget, guint priority,
+               const int *layer)
+{
+  ipm_record_t r;
+
+  if (!records)
+    return;
+
+  if (records->len >= IPM_RECORD_MAX)
+  {
+    dropped++;
+    return;
+  }
+
+  r.timestamp = g_get_monotonic_time();
+  r.op = op;
+  r.priority = priority;
+  r.layer = layer ? *layer : -1;
+  r.widget = widget;
+  r.depth = g_slist_length(window_priority_list);
+  g_array_append_val(records, r);
+}
+
+static void
+ipm_record_show(GtkWidget *widget, guint priority, const int *layer)
+{
+  ipm_record_add(IPM_OP_SHOW, widget, priority, layer);
+}
+
+static void
+ipm_record_hide(GtkWidget *widget)
+{
+  ipm_record_add(IPM_OP_HIDE, widget, 0, NULL);
+}
+
+/* widgets are only recorded by address, they need not be GObjects */
+const ipm_backend_t ipm_backend_record =
+{
+  "record",
+  ipm_record_show,
+  ipm_record_hide,
+  NULL,
+  NULL,
+  NULL
+};
+
+/* one line per operation:
+ * <usecs since start> <show|hide> <priority> <layer> <widget> <depth> */
+static GString *
+ipm_record_print(void)
+{
+  GString *s = g_string_new(NULL);
+  guint i;
+
+  g_string_append_printf(s, "# ipm record: %u operations, %u dropped\n",
+                         records ? records->len : 0, dropped);
+
+  for (i = 0; records && i < records->len; i++)
+  {
+    ipm_record_t *r = &g_array_index(records, ipm_record_t, i);
+
+    g_string_append_printf(s, "%" G_GINT64_FORMAT " %s %u %d %p %u\n",
+                           r->timestamp - start_time,
+                           op_names[r->op],
+                           r->priority, r->layer, r->widget, r->depth);
+  }
+
+  return s;
+}
+
+static int
+ipm_record_handler(const char *interface, const char *method, GArray *args,
+                   system_ui_data *ui, system_ui_handler_arg *result)
+{
+  return dbus_reply_string(result, g_string_free(ipm_record_print(), FALSE));
+}
+
+gboolean
+ipm_record_init(system_ui_data *ui, const char *file)
+{
+  records = g_array_new(FALSE, FALSE, sizeof(ipm_record_t));
+  start_time = g_get_monotonic_time();
+  record_file = g_strdup(file);
+
+  return systemui_add_handler(SYSTEMUI_IPM_RECORD_REQ, ipm_record_handler, ui);
+}
+
+void
+ipm_record_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_IPM_RECORD_REQ, ui);
+
+  if (record_file)
+  {
+    GString *s = ipm_record_print();
+    GError *error = NULL;
+
+    if (!g_file_set_contents(record_file, s->str, s->len, &error))
+    {
+      SYSTEMUI_WARNING("Cannot write IPM record to %s: %s", record_file,
+                       error->message);
+      g_error_free(error);
+    }
+
+    g_string_free(s, TRUE);
+    g_free(record_file);
+    record_file = NULL;
+  }
+
+  if (records)
+  {
+    g_array_free(records, TRUE);
+    records = NULL;
+  }
+}
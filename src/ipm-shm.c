@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <systemui.h>
+
+#include "systemui-ipm-shm.h"
+
+#include "dispatch.h"
+#include "ipm.h"
+#include "settings.h"
+
+static systemui_ipm_shm_t *shm = NULL;
+static system_ui_data *shm_ui = NULL;
+
+void
+ipm_shm_publish(void)
+{
+  systemui_ipm_snapshot_t *snapshot;
+  GSList *top_down;
+  GSList *l;
+  guint i = 0;
+
+  if (!shm)
+    return;
+
+  top_down = g_slist_reverse(g_slist_copy(window_priority_list));
+
+  /* readers retry until they see the same even seq before and after */
+  shm->seq++;
+  __sync_synchronize();
+
+  snapshot = &shm->snapshot;
+  snapshot->count = g_slist_length(window_priority_list);
+  snapshot->timestamp = g_get_monotonic_time();
+
+  for (l = top_down; l && i < SYSTEMUI_IPM_SHM_MAX_WINDOWS; l = l->next, i++)
+  {
+    window_priority_t *wp = l->data;
+    systemui_ipm_window_t *window = &snapshot->stack[i];
+    const int *layer = g_hash_table_lookup(shm_ui->hsl_tab, &wp->priority);
+    const char *name = hsl_name_by_prio(wp->priority);
+
+    window->priority = wp->priority;
+    window->layer = layer ? *layer : -1;
+    g_strlcpy(window->name, name ? name : "", sizeof(window->name));
+  }
+
+  snapshot->listed = i;
+  memset(&snapshot->stack[i], 0,
+         (SYSTEMUI_IPM_SHM_MAX_WINDOWS - i) * sizeof(snapshot->stack[0]));
+
+  __sync_synchronize();
+  shm->seq++;
+
+  g_slist_free(top_down);
+}
+
+gboolean
+ipm_shm_init(system_ui_data *ui)
+{
+  int fd;
+
+  /* loadgen and replay runs must not shadow the real stack */
+  if (ipm_headless() || !settings_get_int(ui, SYSTEMUI_GCONF_IPM_SHM, TRUE))
+    return TRUE;
+
+  /* only called once the bus name is ours, this is not a live instance's.
+   * Readers of a previous one keep their mapping and see pid 0 */
+  shm_unlink(SYSTEMUI_IPM_SHM_NAME);
+  fd = shm_open(SYSTEMUI_IPM_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0644);
+
+  if (fd < 0)
+  {
+    SYSTEMUI_WARNING("Cannot create %s: %s", SYSTEMUI_IPM_SHM_NAME,
+                     strerror(errno));
+    return FALSE;
+  }
+
+  if (ftruncate(fd, sizeof(*shm)) ||
+      (shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                  0)) == MAP_FAILED)
+  {
+    SYSTEMUI_WARNING("Cannot map %s: %s", SYSTEMUI_IPM_SHM_NAME,
+                     strerror(errno));
+    shm = NULL;
+    close(fd);
+    shm_unlink(SYSTEMUI_IPM_SHM_NAME);
+
+    return FALSE;
+  }
+
+  close(fd);
+  shm_ui = ui;
+
+  /* ftruncate zero filled it, seq is even */
+  shm->magic = SYSTEMUI_IPM_SHM_MAGIC;
+  shm->version = SYSTEMUI_IPM_SHM_VERSION;
+  shm->size = sizeof(*shm);
+  shm->pid = getpid();
+  ipm_shm_publish();
+
+  return TRUE;
+}
+
+void
+ipm_shm_finish(system_ui_data *ui)
+{
+  if (!shm)
+    return;
+
+  shm->pid = 0;
+  __sync_synchronize();
+  munmap(shm, sizeof(*shm));
+  shm = NULL;
+  shm_ui = NULL;
+  shm_unlink(SYSTEMUI_IPM_SHM_NAME);
+}
@@ -4,19 +4,123 @@
 #include <systemui.h>
 
 #include "config.h"
+#include "ipm.h"
+#include "plugin.h"
+#include "settings.h"
+#include "stats.h"
+#include "trace.h"
 
-struct window_priority
-{
-  guint32 priority;
-  GtkWidget *widget;
-};
-typedef struct window_priority window_priority_t;
+/* widget data set by systemui_ipm_set_opaque(), unset means autodetect */
+#define IPM_OPAQUE_KEY "systemui-ipm-opaque"
+#define IPM_OPAQUE 1
+#define IPM_TRANSLUCENT 2
 
 extern system_ui_data *app_ui_data;
 
 GSList *window_priority_list = NULL;
 guint window_prio_max = 300;
 
+static gint occlusion = -1;
+static guint occlusion_idle_id = 0;
+
+static void
+ipm_x11_show(GtkWidget *widget, guint priority, const int *layer)
+{
+  GdkDisplay *dpy = gdk_display_get_default();
+
+  gtk_widget_realize(widget);
+
+  if (layer)
+  {
+    Atom hsl_atom =
+        gdk_x11_get_xatom_by_name_for_display(dpy, "_HILDON_STACKING_LAYER");
+
+    XChangeProperty(gdk_x11_display_get_xdisplay(dpy),
+#ifdef WITH_GTK3
+                    gdk_x11_window_get_xid(gtk_widget_get_window(widget)),
+                    hsl_atom,
+#else
+                    gdk_x11_drawable_get_xid(widget->window), hsl_atom,
+#endif
+                    XA_CARDINAL, 32, PropModeReplace,
+                    (unsigned char *)layer, 1);
+  }
+
+  gtk_widget_show_all(widget);
+}
+
+static void
+ipm_x11_hide(GtkWidget *widget)
+{
+#ifdef WITH_GTK3
+  gtk_widget_hide(widget);
+#else
+  gtk_widget_hide_all(widget);
+#endif
+}
+
+/* the window stays visible as far as GTK and the plugin are concerned */
+static void
+ipm_x11_occlude(GtkWidget *widget)
+{
+  gtk_widget_unmap(widget);
+}
+
+static void
+ipm_x11_restore(GtkWidget *widget)
+{
+  if (gtk_widget_get_visible(widget))
+    gtk_widget_map(widget);
+}
+
+static gboolean
+ipm_x11_covers_screen(GtkWidget *widget)
+{
+  GdkScreen *screen = gtk_widget_get_screen(widget);
+  GtkAllocation alloc;
+
+#ifdef WITH_GTK3
+  if (gtk_widget_get_visual(widget) == gdk_screen_get_rgba_visual(screen))
+    return FALSE;
+#else
+  if (gtk_widget_get_colormap(widget) == gdk_screen_get_rgba_colormap(screen))
+    return FALSE;
+#endif
+
+  gtk_widget_get_allocation(widget, &alloc);
+
+  return alloc.x <= 0 && alloc.y <= 0 &&
+      alloc.x + alloc.width >= gdk_screen_get_width(screen) &&
+      alloc.y + alloc.height >= gdk_screen_get_height(screen);
+}
+
+const ipm_backend_t ipm_backend_x11 =
+{
+  "x11",
+  ipm_x11_show,
+  ipm_x11_hide,
+  ipm_x11_occlude,
+  ipm_x11_restore,
+  ipm_x11_covers_screen
+};
+
+static const ipm_backend_t *backend = &ipm_backend_x11;
+
+void
+ipm_set_backend(const ipm_backend_t *new_backend)
+{
+  g_return_if_fail(new_backend != NULL);
+
+  SYSTEMUI_INFO("Using %s IPM backend", new_backend->name);
+  backend = new_backend;
+}
+
+gboolean
+ipm_headless(void)
+{
+  return backend != &ipm_backend_x11;
+}
+
 static gint
 window_priority_compare(gconstpointer _a, gconstpointer _b)
 {
@@ -41,13 +145,146 @@ window_priority_compare_priority(gconstpointer _a, gconstpointer _b)
   return rv;
 }
 
+static gboolean
+ipm_window_opaque(GtkWidget *widget)
+{
+  gint opaque = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(widget),
+                                                  IPM_OPAQUE_KEY));
+
+  if (opaque)
+    return opaque == IPM_OPAQUE;
+
+  return backend->covers_screen && backend->covers_screen(widget);
+}
+
+static gboolean
+ipm_occlusion_enabled(void)
+{
+  if (occlusion < 0)
+  {
+    occlusion = backend->occlude &&
+        settings_get_int(app_ui_data, SYSTEMUI_GCONF_IPM_OCCLUSION, TRUE);
+  }
+
+  return occlusion;
+}
+
+static const int *
+ipm_window_layer(guint priority)
+{
+  g_assert(app_ui_data->hsl_tab != NULL);
+
+  return g_hash_table_lookup(app_ui_data->hsl_tab, &priority);
+}
+
+/* an opaque window above link, in list order as ipm_update_occlusion()
+ * goes */
+static gboolean
+ipm_window_covered(GSList *link)
+{
+  GSList *l;
+
+  if (!ipm_occlusion_enabled())
+    return FALSE;
+
+  for (l = link->next; l; l = l->next)
+  {
+    if (ipm_window_opaque(((window_priority_t *)l->data)->widget))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* everything below the topmost opaque window is occluded */
+static void
+ipm_update_occlusion(void)
+{
+  GSList *top_down;
+  GSList *restore = NULL;
+  GSList *l;
+  gboolean covered = FALSE;
+  guint unmapped = 0;
+  guint occluded = 0;
+
+  if (!ipm_occlusion_enabled())
+    return;
+
+  /* the list is sorted by ascending priority */
+  top_down = g_slist_reverse(g_slist_copy(window_priority_list));
+
+  for (l = top_down; l; l = l->next)
+  {
+    window_priority_t *wp = l->data;
+
+    if (covered)
+    {
+      occluded++;
+
+      if (!wp->occluded)
+      {
+        backend->occlude(wp->widget);
+        wp->occluded = TRUE;
+        unmapped++;
+      }
+
+      continue;
+    }
+
+    /* prepending ends up bottom up, windows sharing a layer keep their
+     * stacking */
+    if (wp->occluded)
+      restore = g_slist_prepend(restore, wp);
+
+    if (ipm_window_opaque(wp->widget))
+      covered = TRUE;
+  }
+
+  g_slist_free(top_down);
+
+  for (l = restore; l; l = l->next)
+  {
+    window_priority_t *wp = l->data;
+
+    if (wp->shown)
+      backend->restore(wp->widget);
+    else
+    {
+      backend->show(wp->widget, wp->priority, ipm_window_layer(wp->priority));
+      wp->shown = TRUE;
+    }
+
+    wp->occluded = FALSE;
+  }
+
+  g_slist_free(restore);
+  stats_ipm_occluded(unmapped, occluded);
+}
+
+static gboolean
+ipm_update_occlusion_idle(gpointer user_data)
+{
+  occlusion_idle_id = 0;
+  ipm_update_occlusion();
+
+  return FALSE;
+}
+
+void
+systemui_ipm_set_opaque(GtkWidget *widget, gboolean opaque)
+{
+  g_return_if_fail(widget != NULL);
+
+  g_object_set_data(G_OBJECT(widget), IPM_OPAQUE_KEY,
+                    GINT_TO_POINTER(opaque ? IPM_OPAQUE : IPM_TRANSLUCENT));
+  ipm_update_occlusion();
+}
+
 gboolean
 ipm_show_window(GtkWidget *widget, unsigned int priority)
 {
   window_priority_t *wp;
   window_priority_t data;
-  GdkDisplay *dpy;
-  gpointer layer;
 
   if (!widget || priority > window_prio_max)
     return FALSE;
@@ -63,37 +300,36 @@ ipm_show_window(GtkWidget *widget, unsigned int priority)
   if (!wp)
     return FALSE;
 
-  dpy = gdk_display_get_default();
-
   wp->priority = priority;
   wp->widget = widget;
+  wp->plugin = plugin_current();
+  plugin_window_shown(wp->plugin);
 
-  gtk_widget_realize(widget);
+  window_priority_list = g_slist_insert_sorted(
+        window_priority_list, wp, window_priority_compare_priority);
 
-  g_assert(app_ui_data->hsl_tab != NULL);
+  /* mapping a window that is unmapped right after flickers, a covered one is
+   * only shown once it gets uncovered */
+  wp->occluded = ipm_window_covered(g_slist_find(window_priority_list, wp));
+  wp->shown = !wp->occluded;
 
-  layer = g_hash_table_lookup(app_ui_data->hsl_tab, &priority);
+  if (wp->shown)
+    backend->show(widget, priority, ipm_window_layer(priority));
 
-  if (layer)
-  {
-    Atom hsl_atom =
-        gdk_x11_get_xatom_by_name_for_display(dpy, "_HILDON_STACKING_LAYER");
+  ipm_update_occlusion();
 
-    XChangeProperty(gdk_x11_display_get_xdisplay(dpy),
-#ifdef WITH_GTK3
-                    gdk_x11_window_get_xid(gtk_widget_get_window(widget)),
-                    hsl_atom,
-#else
-                    gdk_x11_drawable_get_xid(widget->window), hsl_atom,
-#endif
-                    XA_CARDINAL, 32, PropModeReplace,
-                    (unsigned char *)layer, 1);
+  /* the new window is only sized once GTK gets to it */
+  if (!occlusion_idle_id && occlusion)
+  {
+    occlusion_idle_id = g_idle_add_full(GDK_PRIORITY_REDRAW + 10,
+                                        ipm_update_occlusion_idle, NULL,
+                                        NULL);
   }
 
-  window_priority_list = g_slist_insert_sorted(
-        window_priority_list, wp, window_priority_compare_priority);
-
-  gtk_widget_show_all(widget);
+  ipm_shm_publish();
+  stats_ipm_changed(TRUE, g_slist_length(window_priority_list));
+  SYSTEMUI_TRACE(TRACE_LEVEL_VERBOSE, TRACE_EV_IPM_SHOW, NULL, priority,
+                 g_slist_length(window_priority_list), 0);
 
   return TRUE;
 }
@@ -102,6 +338,7 @@ gboolean
 ipm_hide_window(GtkWidget *widget)
 {
   GSList *l;
+  window_priority_t *wp;
   window_priority_t tmp;
 
   if (!widget || !window_priority_list || !g_slist_length(window_priority_list))
@@ -114,19 +351,25 @@ ipm_hide_window(GtkWidget *widget)
                           (GCompareFunc)window_priority_compare)))
     return FALSE;
 
-  if (l->data)
-    g_free(l->data);
-
+  wp = l->data;
   window_priority_list = g_slist_delete_link(window_priority_list, l);
-#ifdef WITH_GTK3
-  gtk_widget_hide(widget);
-#else
-  gtk_widget_hide_all(widget);
-#endif
 
-#if 0 /* Why is that? */
-  g_slist_length(window_priority_list);
-#endif
+  if (wp)
+  {
+    plugin_window_hidden(wp->plugin);
+
+    if (wp->shown)
+      backend->hide(widget);
+
+    g_free(wp);
+  }
+
+  ipm_update_occlusion();
+
+  ipm_shm_publish();
+  stats_ipm_changed(FALSE, g_slist_length(window_priority_list));
+  SYSTEMUI_TRACE(TRACE_LEVEL_VERBOSE, TRACE_EV_IPM_HIDE, NULL, 0,
+                 g_slist_length(window_priority_list), 0);
 
   return TRUE;
 }
@@ -0,0 +1,63 @@
+#ifndef SYSTEMUI_IPM_H
+#define SYSTEMUI_IPM_H
+
+#define SYSTEMUI_IPM_RECORD_REQ "ipm_record_get"
+
+/* recorded operations kept in memory, later ones are only counted */
+#define IPM_RECORD_MAX 65536
+
+/* what actually puts windows on screen, the window priority list itself is
+ * maintained by ipm.c regardless */
+typedef struct
+{
+  const char *name;
+  /* layer is NULL if priority has no stacking layer */
+  void (*show)(GtkWidget *widget, guint priority, const int *layer);
+  void (*hide)(GtkWidget *widget);
+  /* take a shown window off screen while it is covered and put it back.
+   * NULL if windows never reach a screen, they are then not looked at
+   * beyond their address, plugins may pass anything */
+  void (*occlude)(GtkWidget *widget);
+  void (*restore)(GtkWidget *widget);
+  /* NULL if the backend cannot tell, then only systemui_ipm_set_opaque()
+   * makes a window opaque */
+  gboolean (*covers_screen)(GtkWidget *widget);
+} ipm_backend_t;
+
+extern const ipm_backend_t ipm_backend_x11;
+extern const ipm_backend_t ipm_backend_record;
+
+/* 0 keeps covered windows mapped */
+#define SYSTEMUI_GCONF_IPM_OCCLUSION SYSTEMUI_GCONF_DIR "ipm_occlusion"
+
+struct window_priority
+{
+  guint32 priority;
+  GtkWidget *widget;
+  gpointer plugin;
+  gboolean occluded; /* taken off screen by us */
+  gboolean shown; /* FALSE if it was covered from the start */
+};
+typedef struct window_priority window_priority_t;
+
+/* window_priority_t, by ascending priority */
+extern GSList *window_priority_list;
+
+void ipm_set_backend(const ipm_backend_t *backend);
+/* TRUE if windows never reach a display */
+gboolean ipm_headless(void);
+
+/* ipm-record.c, file is written on finish if not NULL */
+gboolean ipm_record_init(system_ui_data *ui, const char *file);
+void ipm_record_finish(system_ui_data *ui);
+
+/* 0 does not publish the window stack in shared memory */
+#define SYSTEMUI_GCONF_IPM_SHM SYSTEMUI_GCONF_DIR "ipm_shm"
+
+/* ipm-shm.c, for systemui-ipm-shm.h readers. Init only once the bus name is
+ * owned, it replaces any existing segment */
+gboolean ipm_shm_init(system_ui_data *ui);
+void ipm_shm_publish(void);
+void ipm_shm_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_IPM_H
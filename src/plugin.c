@@ -6,6 +6,15 @@
 #include <string.h>
 #include <systemui.h>
 #include <errno.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "dbus.h"
+#include "plugin.h"
+#include "settings.h"
+#include "stats.h"
+#include "trace.h"
+#include "wakeup.h"
 
 GSList *plugin_list;
 
@@ -13,12 +22,30 @@ enum plugin_state
 {
   UNLOADED,
   LOADED,
-  ERROR
+  ERROR,
+  IDLE /* unloaded after being idle, proxy handlers in place */
 };
 typedef enum plugin_state plugin_state_t;
 
 typedef gboolean (*plugin_init_f)(system_ui_data *);
 typedef void (*plugin_close_f)(system_ui_data *);
+typedef gboolean (*plugin_can_unload_f)(system_ui_data *);
+typedef void (*plugin_locale_changed_f)(system_ui_data *, const char *);
+
+/* heap growth sampled around plugin code, there are no malloc hooks anymore
+ * so frees done outside of plugin code are not accounted */
+/* net heap change across calls into the plugin (handlers, init and close),
+ * allocations and frees from its own callbacks and timeouts are not seen.
+ * An estimate of what the plugin keeps, not its live heap */
+struct plugin_mem
+{
+  gssize growth;
+  gssize peak;
+  guint calls;
+  guint grows;
+  gssize budget;
+  gboolean over_budget;
+};
 
 struct plugin
 {
@@ -28,12 +55,277 @@ struct plugin
   plugin_init_f plugin_init;
   plugin_close_f plugin_close;
   system_ui_data *ui;
+  struct plugin_mem mem;
+  gsize mem_enter;
+  guint depth;
+  struct plugin *prev;
+  gint64 last_used;
+  guint windows;
+  guint unloads;
+  gint64 cpu_enter;
+  gint64 cpu_usecs;
 };
 typedef struct plugin plugin_t;
 
+static gboolean mem_accounting = FALSE;
+static guint idle_timeout = 0;
+static guint idle_check_id = 0;
+/* IPM windows shown outside of any plugin code */
+static guint unowned_windows = 0;
+static plugin_t *current_plugin = NULL;
+/* handler name -> plugin_t */
+static GTree *handler_owners = NULL;
+/* overrides SYSTEMUI_GCONF_PLUGIN_PATH */
+static gchar *plugin_path = NULL;
+
+static const char *
+plugin_name(plugin_t *plugin)
+{
+  const char *name = strrchr(plugin->fname, '/');
+
+  return name ? name + 1 : plugin->fname;
+}
+
+static gsize
+heap_in_use(void)
+{
+#ifdef HAVE_MALLINFO2
+  struct mallinfo2 mi = mallinfo2();
+#else
+  /* deprecated in newer glibc, which has mallinfo2() */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  struct mallinfo mi = mallinfo();
+#pragma GCC diagnostic pop
+#endif
+
+  return (gsize)mi.uordblks + (gsize)mi.hblkhd;
+}
+
+static void
+plugin_mem_enter(plugin_t *plugin)
+{
+  if (!plugin->depth++)
+  {
+    plugin->prev = current_plugin;
+    current_plugin = plugin;
+    plugin->last_used = g_get_monotonic_time();
+    plugin->cpu_enter = wakeup_thread_cpu_time();
+
+    if (mem_accounting)
+      plugin->mem_enter = heap_in_use();
+  }
+}
+
+static void
+plugin_mem_leave(plugin_t *plugin)
+{
+  struct plugin_mem *mem = &plugin->mem;
+  gssize delta;
+
+  if (--plugin->depth)
+    return;
+
+  current_plugin = plugin->prev;
+  plugin->prev = NULL;
+  plugin->cpu_usecs += wakeup_thread_cpu_time() - plugin->cpu_enter;
+
+  if (!mem_accounting)
+    return;
+
+  delta = (gssize)heap_in_use() - (gssize)plugin->mem_enter;
+  mem->calls++;
+
+  if (delta > 0)
+    mem->grows++;
+
+  mem->growth += delta;
+
+  if (mem->growth > mem->peak)
+    mem->peak = mem->growth;
+
+  if (mem->budget && mem->growth > mem->budget)
+  {
+    if (!mem->over_budget)
+    {
+      SYSTEMUI_WARNING("Plugin %s heap growth over budget, %ld > %ld bytes",
+                       plugin_name(plugin), (long)mem->growth,
+                       (long)mem->budget);
+      mem->over_budget = TRUE;
+    }
+  }
+  else
+    mem->over_budget = FALSE;
+}
+
+gpointer
+plugin_enter(const char *handler)
+{
+  plugin_t *plugin;
+
+  if (!handler_owners || !(plugin = g_tree_lookup(handler_owners, handler)))
+    return NULL;
+
+  plugin_mem_enter(plugin);
+
+  return plugin;
+}
+
+void
+plugin_leave(gpointer plugin)
+{
+  if (plugin)
+    plugin_mem_leave(plugin);
+}
+
+const char *
+plugin_get_name(gpointer plugin)
+{
+  return plugin ? plugin_name(plugin) : NULL;
+}
+
+gpointer
+plugin_current(void)
+{
+  return current_plugin;
+}
+
+void
+plugin_window_shown(gpointer plugin)
+{
+  if (plugin)
+    ((plugin_t *)plugin)->windows++;
+  else
+    unowned_windows++;
+}
+
+void
+plugin_window_hidden(gpointer plugin)
+{
+  if (plugin)
+  {
+    if (((plugin_t *)plugin)->windows)
+      ((plugin_t *)plugin)->windows--;
+  }
+  else if (unowned_windows)
+    unowned_windows--;
+}
+
+void
+plugin_handler_added(const char *name)
+{
+  if (!current_plugin)
+    return;
+
+  if (!handler_owners)
+  {
+    handler_owners = g_tree_new_full((GCompareDataFunc)g_ascii_strcasecmp,
+                                     NULL, g_free, NULL);
+  }
+
+  g_tree_replace(handler_owners, g_strdup(name), current_plugin);
+}
+
+void
+plugin_handler_removed(const char *name)
+{
+  if (handler_owners)
+    g_tree_remove(handler_owners, name);
+}
+
+static gboolean
+collect_plugin_handlers(gpointer key, gpointer value, gpointer data)
+{
+  gpointer *args = data;
+
+  if (value == args[0])
+    args[1] = g_slist_prepend(args[1], key);
+
+  return FALSE;
+}
+
+/* returned names must be freed with g_slist_free_full(l, g_free) */
+static GSList *
+plugin_get_handlers(plugin_t *plugin)
+{
+  gpointer args[2] = {plugin, NULL};
+  GSList *l;
+
+  if (!handler_owners)
+    return NULL;
+
+  g_tree_foreach(handler_owners, collect_plugin_handlers, args);
+
+  for (l = args[1]; l; l = l->next)
+    l->data = g_strdup(l->data);
+
+  return args[1];
+}
+
+static void
+plugin_remove_handler_owners(plugin_t *plugin)
+{
+  GSList *handlers = plugin_get_handlers(plugin);
+  GSList *l;
+
+  for (l = handlers; l; l = l->next)
+    g_tree_remove(handler_owners, l->data);
+
+  g_slist_free_full(handlers, g_free);
+}
+
+static void
+plugin_print(plugin_t *plugin, GString *s)
+{
+  g_string_append_printf(
+        s,
+        "plugin %s state=%d growth_bytes=%ld peak_growth_bytes=%ld calls=%u "
+        "heap_grows=%u budget_bytes=%ld idle_unloads=%u\n",
+        plugin_name(plugin), plugin->state, (long)plugin->mem.growth,
+        (long)plugin->mem.peak, plugin->mem.calls, plugin->mem.grows,
+        (long)plugin->mem.budget, plugin->unloads);
+}
+
+void
+plugin_print_stats(GString *s)
+{
+  g_slist_foreach(plugin_list, (GFunc)plugin_print, s);
+}
+
+static void
+plugin_print_cpu_one(plugin_t *plugin, GString *s)
+{
+  g_string_append_printf(s, "plugin %s cpu_us=%lld\n", plugin_name(plugin),
+                         (long long)plugin->cpu_usecs);
+}
+
+void
+plugin_print_cpu(GString *s)
+{
+  g_slist_foreach(plugin_list, (GFunc)plugin_print_cpu_one, s);
+}
+
+static void
+plugin_reset(plugin_t *plugin, gpointer user_data)
+{
+  plugin->mem.peak = plugin->mem.growth;
+  plugin->mem.calls = 0;
+  plugin->mem.grows = 0;
+  plugin->cpu_usecs = 0;
+}
+
+void
+plugin_reset_stats(void)
+{
+  g_slist_foreach(plugin_list, (GFunc)plugin_reset, NULL);
+}
+
 void
 plugin_load(plugin_t *plugin, gboolean *previous_ok)
 {
+  gint64 start = g_get_monotonic_time();
+  gboolean ok;
+
   if (!*previous_ok)
   {
     ULOG_WARN("Plugin %s loading skipped, error occured while previous plugin",
@@ -45,13 +337,24 @@ plugin_load(plugin_t *plugin, gboolean *previous_ok)
       !(plugin->plugin_init =
         (plugin_init_f)dlsym(plugin->handle, "plugin_init")) ||
       !(plugin->plugin_close =
-        (plugin_close_f)dlsym(plugin->handle, "plugin_close")) ||
-      !plugin->plugin_init(plugin->ui))
+        (plugin_close_f)dlsym(plugin->handle, "plugin_close")))
   {
       goto err;
   }
 
+  plugin_mem_enter(plugin);
+  ok = plugin->plugin_init(plugin->ui);
+  plugin_mem_leave(plugin);
+
+  if (!ok)
+    goto err;
+
   plugin->state = LOADED;
+  plugin->last_used = g_get_monotonic_time();
+  stats_plugin_loaded(TRUE, g_get_monotonic_time() - start);
+  SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_PLUGIN_LOAD,
+                 plugin_name(plugin), TRUE,
+                 g_get_monotonic_time() - start, 0);
 
   return;
 
@@ -64,8 +367,13 @@ err:
       plugin->handle = 0;
     }
 
+    plugin_remove_handler_owners(plugin);
     plugin->state = ERROR;
     *previous_ok = FALSE;
+    stats_plugin_loaded(FALSE, g_get_monotonic_time() - start);
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_PLUGIN_LOAD,
+                   plugin_name(plugin), FALSE,
+                   g_get_monotonic_time() - start, 0);
 }
 
 void
@@ -73,11 +381,17 @@ plugin_unload(plugin_t *plugin, gpointer user_data)
 {
   if (plugin->handle)
   {
+    SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_PLUGIN_UNLOAD,
+                   plugin_name(plugin), 0, 0, 0);
+    plugin_mem_enter(plugin);
     plugin->plugin_close(plugin->ui);
+    plugin_mem_leave(plugin);
     dlclose(plugin->handle);
     plugin->handle = NULL;
   }
 
+  plugin_remove_handler_owners(plugin);
+
   if (plugin->fname)
   {
     free(plugin->fname);
@@ -88,13 +402,205 @@ plugin_unload(plugin_t *plugin, gpointer user_data)
   free(plugin);
 }
 
+static int
+plugin_proxy_handler(const char *interface, const char *method, GArray *args,
+                     system_ui_data *ui, system_ui_handler_arg *result)
+{
+  plugin_t *plugin = handler_owners ? g_tree_lookup(handler_owners, method) :
+                                      NULL;
+  GSList *handlers;
+  GSList *l;
+  gboolean ok = TRUE;
+  system_ui_handler handler;
+
+  if (!plugin || plugin->state != IDLE)
+    return 'm';
+
+  ULOG_INFO("Reloading idle plugin %s", plugin->fname);
+
+  /* systemui_remove_handler() drops ownership too, restored by plugin_init */
+  handlers = plugin_get_handlers(plugin);
+
+  for (l = handlers; l; l = l->next)
+    systemui_remove_handler(l->data, ui);
+
+  g_slist_free_full(handlers, g_free);
+
+  plugin_load(plugin, &ok);
+
+  if (!ok)
+    return 'm';
+
+  handler = g_tree_lookup(ui->handlers, method);
+
+  if (!handler || handler == plugin_proxy_handler)
+    return 'm';
+
+  return handler(interface, method, args, ui, result);
+}
+
+static void
+plugin_idle_unload(plugin_t *plugin)
+{
+  GSList *handlers = plugin_get_handlers(plugin);
+  GSList *signatures = NULL;
+  GSList *l;
+  GSList *sig;
+
+  ULOG_INFO("Unloading idle plugin %s", plugin->fname);
+  SYSTEMUI_TRACE(TRACE_LEVEL_INFO, TRACE_EV_PLUGIN_UNLOAD,
+                 plugin_name(plugin), 1, 0, 0);
+
+  /* proxies must reject what the real handlers would */
+  for (l = handlers; l; l = l->next)
+  {
+    signatures = g_slist_append(signatures,
+                                (gpointer)handler_get_signature(l->data));
+  }
+
+  plugin_mem_enter(plugin);
+  plugin->plugin_close(plugin->ui);
+  plugin_mem_leave(plugin);
+
+  /* anything plugin_close() left behind points to unmapped code */
+  for (l = handlers; l; l = l->next)
+    systemui_remove_handler(l->data, plugin->ui);
+
+  dlclose(plugin->handle);
+  plugin->handle = NULL;
+  plugin->plugin_init = NULL;
+  plugin->plugin_close = NULL;
+  plugin->state = IDLE;
+  plugin->unloads++;
+
+  for (l = handlers, sig = signatures; l; l = l->next, sig = sig->next)
+  {
+    systemui_add_handler_with_signature(l->data, plugin_proxy_handler,
+                                        sig->data, plugin->ui);
+    g_tree_replace(handler_owners, g_strdup(l->data), plugin);
+  }
+
+  g_slist_free(signatures);
+  g_slist_free_full(handlers, g_free);
+}
+
+static void
+plugin_idle_check_one(plugin_t *plugin, gint64 *now)
+{
+  plugin_can_unload_f can_unload;
+
+  if (plugin->state != LOADED || plugin->depth || plugin->windows ||
+      *now - plugin->last_used < (gint64)idle_timeout * G_USEC_PER_SEC)
+  {
+    return;
+  }
+
+  /* only plugins that explicitly support it, the rest may have GTypes,
+   * timers or notifiers pointing into their code */
+  can_unload = (plugin_can_unload_f)dlsym(plugin->handle, "plugin_can_unload");
+
+  if (can_unload && can_unload(plugin->ui))
+    plugin_idle_unload(plugin);
+}
+
+static void
+plugin_locale_changed_one(plugin_t *plugin, const char *locale)
+{
+  plugin_locale_changed_f locale_changed;
+
+  /* idle ones come back with the new locale anyway */
+  if (plugin->state != LOADED)
+    return;
+
+  locale_changed = (plugin_locale_changed_f)dlsym(plugin->handle,
+                                                  "plugin_locale_changed");
+
+  if (locale_changed)
+  {
+    plugin_mem_enter(plugin);
+    locale_changed(plugin->ui, locale);
+    plugin_mem_leave(plugin);
+  }
+}
+
+void
+plugin_notify_locale_changed(const char *locale)
+{
+  g_slist_foreach(plugin_list, (GFunc)plugin_locale_changed_one,
+                  (gpointer)locale);
+}
+
+static gboolean
+plugin_idle_check(gpointer user_data)
+{
+  gint64 now = g_get_monotonic_time();
+
+  /* a window we can't attribute might belong to any of them */
+  if (!unowned_windows)
+    g_slist_foreach(plugin_list, (GFunc)plugin_idle_check_one, &now);
+
+  return TRUE;
+}
+
 void
 close_plugins()
 {
   ULOG_INFO("Unloading all plugins");
+
+  if (idle_check_id)
+  {
+    systemui_timeout_remove(idle_check_id);
+    idle_check_id = 0;
+  }
+
   g_slist_foreach(plugin_list, (GFunc)plugin_unload, NULL);
   g_slist_free(plugin_list);
   plugin_list = NULL;
+
+  if (handler_owners)
+  {
+    g_tree_destroy(handler_owners);
+    handler_owners = NULL;
+  }
+}
+
+static gssize
+plugin_budget(const gchar *budgets, const gchar *name, gssize def)
+{
+  gchar **entries;
+  gchar **entry;
+  gssize rv = def;
+
+  if (!budgets)
+    return def;
+
+  entries = g_strsplit(budgets, ",", -1);
+
+  for (entry = entries; *entry; entry++)
+  {
+    gchar **fields = g_strsplit(g_strstrip(*entry), ":", 2);
+
+    if (g_strv_length(fields) == 2 && !strcmp(fields[0], name))
+      rv = (gssize)atoi(fields[1]) * 1024;
+
+    g_strfreev(fields);
+  }
+
+  g_strfreev(entries);
+
+  return rv;
+}
+
+void
+plugin_set_path(const char *path)
+{
+  g_free(plugin_path);
+
+  /* file names are appended as they are */
+  if (path && !g_str_has_suffix(path, G_DIR_SEPARATOR_S))
+    plugin_path = g_strconcat(path, G_DIR_SEPARATOR_S, NULL);
+  else
+    plugin_path = g_strdup(path);
 }
 
 gboolean
@@ -105,22 +611,43 @@ init_plugins(system_ui_data *app_ui_data)
   gboolean try_load = FALSE;
   gboolean result = FALSE;
   gboolean load_ok = TRUE;
+  gssize default_budget;
+  gchar *budgets;
 
   ULOG_INFO("Loading all plugins");
 
-  prefix = gconf_client_get_string(app_ui_data->gc_client,
-                                   SYSTEMUI_GCONF_PLUGIN_PREFIX, NULL);
+  mem_accounting = settings_get_int(app_ui_data,
+                                    SYSTEMUI_GCONF_PLUGIN_MEM_ACCOUNTING, 0);
+  default_budget = (gssize)settings_get_int(app_ui_data,
+                                            SYSTEMUI_GCONF_PLUGIN_MEM_BUDGET,
+                                            0) * 1024;
+  budgets = settings_get_string(app_ui_data,
+                                SYSTEMUI_GCONF_PLUGIN_MEM_BUDGETS);
+
+  if (!mem_accounting && (default_budget || budgets))
+  {
+    SYSTEMUI_WARNING("Plugin memory budgets are not checked, %s is off",
+                     SYSTEMUI_GCONF_PLUGIN_MEM_ACCOUNTING);
+  }
+
+  idle_timeout = settings_get_int(app_ui_data,
+                                  SYSTEMUI_GCONF_PLUGIN_IDLE_TIMEOUT, 0);
+
+  prefix = settings_get_string(app_ui_data, SYSTEMUI_GCONF_PLUGIN_PREFIX);
   if (!prefix)
   {
-    ULOG_INFO("GConf key for plugin prefix not found, using default prefix");
+    ULOG_INFO("Plugin prefix not configured, using default prefix");
     prefix = g_strdup("libsystemuiplugin_");
   }
 
-  path = gconf_client_get_string(app_ui_data->gc_client,
-                                 SYSTEMUI_GCONF_PLUGIN_PATH, NULL);
+  if (plugin_path)
+    path = g_strdup(plugin_path);
+  else
+    path = settings_get_string(app_ui_data, SYSTEMUI_GCONF_PLUGIN_PATH);
+
   if (!path)
   {
-    ULOG_INFO("GConf key for plugin path not found, using default path");
+    ULOG_INFO("Plugin path not configured, using default path");
     path = g_strdup("/usr/lib/systemui/");
   }
 
@@ -154,10 +681,13 @@ init_plugins(system_ui_data *app_ui_data)
           goto EXIT;
         }
 
+        memset(plugin_list_item, 0, sizeof(*plugin_list_item));
         plugin_list_item->handle = NULL;
         plugin_list_item->state = UNLOADED;
         plugin_list_item->ui = app_ui_data;
         plugin_list_item->fname = g_strconcat(path, dirent->d_name, NULL);
+        plugin_list_item->mem.budget = plugin_budget(budgets, dirent->d_name,
+                                                     default_budget);
         plugin_list = g_slist_append(plugin_list, plugin_list_item);
       }
     }
@@ -167,6 +697,8 @@ init_plugins(system_ui_data *app_ui_data)
   }
 
 EXIT:
+  g_free(budgets);
+
   if (path)
     g_free(path);
 
@@ -178,7 +710,15 @@ EXIT:
     g_slist_foreach(plugin_list, (GFunc)plugin_load, &load_ok);
 
     if (load_ok)
+    {
       result = TRUE;
+
+      if (idle_timeout)
+      {
+        idle_check_id = systemui_timeout_add_seconds(MAX(idle_timeout / 2, 1),
+                                                     plugin_idle_check, NULL);
+      }
+    }
     else
     {
       SYSTEMUI_WARNING("Failed to load (some) plugin(s)");
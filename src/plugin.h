@@ -1,7 +1,49 @@
 #ifndef PLUGIN_H
 #define PLUGIN_H
 
+/* 1 measures the heap around every call into a plugin, off by default as
+ * mallinfo() walks all arenas. Budgets are only checked with it. Only the
+ * growth across those calls is counted, not what plugin callbacks allocate */
+#define SYSTEMUI_GCONF_PLUGIN_MEM_ACCOUNTING \
+  SYSTEMUI_GCONF_DIR "plugin_mem_accounting"
+/* soft per plugin budget for that growth in KiB, 0 for none */
+#define SYSTEMUI_GCONF_PLUGIN_MEM_BUDGET SYSTEMUI_GCONF_DIR "plugin_mem_budget"
+/* "libsystemuiplugin_foo.so:KiB,..." per plugin overrides */
+#define SYSTEMUI_GCONF_PLUGIN_MEM_BUDGETS \
+  SYSTEMUI_GCONF_DIR "plugin_mem_budgets"
+
+/* seconds a plugin has to be unused before it gets unloaded, 0 disables.
+ * Only plugins exporting gboolean plugin_can_unload(system_ui_data *) that
+ * returns TRUE are unloaded, they are reloaded on the next request */
+#define SYSTEMUI_GCONF_PLUGIN_IDLE_TIMEOUT \
+  SYSTEMUI_GCONF_DIR "plugin_idle_timeout"
+
+/* plugin directory to use instead of the configured one, NULL to reset */
+void plugin_set_path(const char *path);
 gboolean init_plugins(system_ui_data *app_ui_data);
 void close_plugins();
 
+/* bracket calls into the plugin owning handler, returns NULL for core ones */
+gpointer plugin_enter(const char *handler);
+void plugin_leave(gpointer plugin);
+
+/* file name of a plugin returned by plugin_enter(), NULL for NULL */
+const char *plugin_get_name(gpointer plugin);
+
+/* owner of IPM windows */
+gpointer plugin_current(void);
+void plugin_window_shown(gpointer plugin);
+void plugin_window_hidden(gpointer plugin);
+
+void plugin_handler_added(const char *name);
+void plugin_handler_removed(const char *name);
+
+/* calls the optional plugin_locale_changed() of loaded plugins */
+void plugin_notify_locale_changed(const char *locale);
+
+void plugin_print_stats(GString *s);
+/* CPU time spent in plugin code */
+void plugin_print_cpu(GString *s);
+void plugin_reset_stats(void);
+
 #endif // PLUGIN_H
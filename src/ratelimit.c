@@ -0,0 +1,453 @@
+#include <string.h>
+#include <stdlib.h>
+#include <systemui.h>
+
+#include "dispatch.h"
+#include "ratelimit.h"
+#include "settings.h"
+
+#define RATELIMIT_DEFAULT_RATE 0
+#define RATELIMIT_DEFAULT_BURST 20
+#define RATELIMIT_DEFAULT_COALESCE_MS 0
+
+/* the least recently seen sender is dropped to make room for a new one */
+#define RATELIMIT_MAX_SENDERS 256
+
+struct ratelimit_config
+{
+  guint rate;
+  guint burst;
+};
+typedef struct ratelimit_config ratelimit_config_t;
+
+struct ratelimit_bucket
+{
+  gdouble tokens;
+  gint64 last;
+};
+typedef struct ratelimit_bucket ratelimit_bucket_t;
+
+struct ratelimit_sender
+{
+  GList lru; /* data points back to the sender */
+  gchar *name;
+  /* registered handler name -> ratelimit_bucket_t, bounded by the number of
+   * handlers as unknown methods never get here */
+  GHashTable *buckets;
+  /* the last call and its reply, for coalescing */
+  DBusMessage *call;
+  gchar *method;
+  gint64 call_time;
+  DBusMessage *reply;
+};
+typedef struct ratelimit_sender ratelimit_sender_t;
+
+static ratelimit_config_t default_config =
+{
+  RATELIMIT_DEFAULT_RATE,
+  RATELIMIT_DEFAULT_BURST
+};
+
+static gint64 coalesce_usecs = RATELIMIT_DEFAULT_COALESCE_MS * 1000;
+
+/* method -> ratelimit_config_t, names compared ignoring case as handlers
+ * are */
+static GHashTable *method_configs = NULL;
+/* unique name -> ratelimit_sender_t */
+static GHashTable *senders = NULL;
+/* ratelimit_sender_t, most recently seen first */
+static GQueue sender_lru = G_QUEUE_INIT;
+static guint config_notify_id = 0;
+static guint reload_id = 0;
+
+/* critical requests, screen lock and shutdown from MCE and DSME, are never
+ * limited or coalesced */
+static gboolean
+ratelimit_enabled(const char *method)
+{
+  if (!default_config.rate && !g_hash_table_size(method_configs) &&
+      !coalesce_usecs)
+  {
+    return FALSE;
+  }
+
+  return !dispatch_class_is_critical(dispatch_member_class(method));
+}
+
+static guint
+method_hash(gconstpointer key)
+{
+  const char *p;
+  guint h = 5381;
+
+  for (p = key; *p; p++)
+    h = h * 33 + g_ascii_tolower(*p);
+
+  return h;
+}
+
+static gboolean
+method_equal(gconstpointer a, gconstpointer b)
+{
+  return !g_ascii_strcasecmp(a, b);
+}
+
+static gboolean
+dbus_iter_equal(DBusMessageIter *a, DBusMessageIter *b)
+{
+  int type;
+
+  while ((type = dbus_message_iter_get_arg_type(a)) ==
+         dbus_message_iter_get_arg_type(b))
+  {
+    if (type == DBUS_TYPE_INVALID)
+      return TRUE;
+
+    if (dbus_type_is_basic(type))
+    {
+      DBusBasicValue va;
+      DBusBasicValue vb;
+
+      memset(&va, 0, sizeof(va));
+      memset(&vb, 0, sizeof(vb));
+      dbus_message_iter_get_basic(a, &va);
+      dbus_message_iter_get_basic(b, &vb);
+
+      if (dbus_type_is_fixed(type) ? memcmp(&va, &vb, sizeof(va)) :
+                                     strcmp(va.str, vb.str))
+      {
+        return FALSE;
+      }
+    }
+    else
+    {
+      DBusMessageIter sa;
+      DBusMessageIter sb;
+
+      dbus_message_iter_recurse(a, &sa);
+      dbus_message_iter_recurse(b, &sb);
+
+      /* the message signatures do not cover what variants hold */
+      if (type == DBUS_TYPE_VARIANT)
+      {
+        char *siga = dbus_message_iter_get_signature(&sa);
+        char *sigb = dbus_message_iter_get_signature(&sb);
+        gboolean same = !strcmp(siga, sigb);
+
+        dbus_free(siga);
+        dbus_free(sigb);
+
+        if (!same)
+          return FALSE;
+      }
+
+      if (!dbus_iter_equal(&sa, &sb))
+        return FALSE;
+    }
+
+    dbus_message_iter_next(a);
+    dbus_message_iter_next(b);
+  }
+
+  return FALSE;
+}
+
+/* the whole body, a hash would let colliding requests get each other's
+ * reply */
+static gboolean
+message_args_equal(DBusMessage *a, DBusMessage *b)
+{
+  DBusMessageIter ia;
+  DBusMessageIter ib;
+
+  if (strcmp(dbus_message_get_signature(a), dbus_message_get_signature(b)))
+    return FALSE;
+
+  if (!dbus_message_iter_init(a, &ia))
+    return TRUE;
+
+  dbus_message_iter_init(b, &ib);
+
+  return dbus_iter_equal(&ia, &ib);
+}
+
+static void
+sender_forget_call(ratelimit_sender_t *sender)
+{
+  if (sender->call)
+    dbus_message_unref(sender->call);
+
+  if (sender->reply)
+    dbus_message_unref(sender->reply);
+
+  g_free(sender->method);
+  sender->call = NULL;
+  sender->reply = NULL;
+  sender->method = NULL;
+}
+
+static void
+sender_free(gpointer data)
+{
+  ratelimit_sender_t *sender = data;
+
+  g_queue_unlink(&sender_lru, &sender->lru);
+  sender_forget_call(sender);
+  g_hash_table_destroy(sender->buckets);
+  g_free(sender->name);
+  g_free(sender);
+}
+
+static ratelimit_sender_t *
+sender_get(DBusMessage *msg)
+{
+  const char *name = dbus_message_get_sender(msg);
+  ratelimit_sender_t *sender = g_hash_table_lookup(senders, name);
+
+  if (sender)
+  {
+    g_queue_unlink(&sender_lru, &sender->lru);
+    g_queue_push_head_link(&sender_lru, &sender->lru);
+
+    return sender;
+  }
+
+  if (g_queue_get_length(&sender_lru) >= RATELIMIT_MAX_SENDERS)
+  {
+    ratelimit_sender_t *oldest = g_queue_peek_tail(&sender_lru);
+
+    g_hash_table_remove(senders, oldest->name);
+  }
+
+  sender = g_new0(ratelimit_sender_t, 1);
+  sender->lru.data = sender;
+  sender->name = g_strdup(name);
+  sender->buckets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                          g_free);
+  g_hash_table_insert(senders, sender->name, sender);
+  g_queue_push_head_link(&sender_lru, &sender->lru);
+
+  return sender;
+}
+
+/* FALSE if the sender is out of tokens for method */
+static gboolean
+sender_take_token(ratelimit_sender_t *sender, const char *method, gint64 now)
+{
+  ratelimit_config_t *config = g_hash_table_lookup(method_configs, method);
+  ratelimit_bucket_t *bucket;
+
+  if (!config)
+    config = &default_config;
+
+  if (!config->rate)
+    return TRUE;
+
+  if (!(bucket = g_hash_table_lookup(sender->buckets, method)))
+  {
+    bucket = g_new(ratelimit_bucket_t, 1);
+    bucket->tokens = config->burst;
+    bucket->last = now;
+    g_hash_table_insert(sender->buckets, g_strdup(method), bucket);
+  }
+
+  bucket->tokens += (gdouble)(now - bucket->last) * config->rate /
+      G_USEC_PER_SEC;
+
+  if (bucket->tokens > config->burst)
+    bucket->tokens = config->burst;
+
+  bucket->last = now;
+
+  if (bucket->tokens < 1.0)
+    return FALSE;
+
+  bucket->tokens -= 1.0;
+
+  return TRUE;
+}
+
+ratelimit_result_t
+ratelimit_check(DBusMessage *msg, const char *method, DBusMessage **reply)
+{
+  ratelimit_sender_t *sender;
+  gint64 now = g_get_monotonic_time();
+
+  *reply = NULL;
+
+  if (!ratelimit_enabled(method))
+    return RATELIMIT_PASS;
+
+  sender = sender_get(msg);
+
+  if (coalesce_usecs && sender->call && !strcmp(sender->method, method) &&
+      now - sender->call_time < coalesce_usecs &&
+      message_args_equal(sender->call, msg))
+  {
+    if (sender->reply && !dbus_message_get_no_reply(msg))
+    {
+      *reply = dbus_message_copy(sender->reply);
+
+      if (*reply)
+      {
+        dbus_message_set_reply_serial(*reply, dbus_message_get_serial(msg));
+        dbus_message_set_destination(*reply, dbus_message_get_sender(msg));
+      }
+    }
+
+    /* without a reply to repeat the client has to be told */
+    if (*reply || dbus_message_get_no_reply(msg))
+      return RATELIMIT_COALESCED;
+  }
+
+  /* whatever came in between may have changed what the reply would be */
+  sender_forget_call(sender);
+
+  if (!sender_take_token(sender, method, now))
+    return RATELIMIT_REJECT;
+
+  if (coalesce_usecs)
+  {
+    sender->call = dbus_message_ref(msg);
+    sender->method = g_strdup(method);
+    sender->call_time = now;
+  }
+
+  return RATELIMIT_PASS;
+}
+
+gboolean
+ratelimit_charge(DBusMessage *msg, const char *method)
+{
+  ratelimit_sender_t *sender;
+
+  if (!ratelimit_enabled(method))
+    return TRUE;
+
+  sender = sender_get(msg);
+  sender_forget_call(sender);
+
+  return sender_take_token(sender, method, g_get_monotonic_time());
+}
+
+void
+ratelimit_store_reply(DBusMessage *msg, DBusMessage *reply)
+{
+  ratelimit_sender_t *sender;
+
+  if (!coalesce_usecs)
+    return;
+
+  sender = g_hash_table_lookup(senders, dbus_message_get_sender(msg));
+
+  if (sender && sender->call == msg)
+  {
+    if (sender->reply)
+      dbus_message_unref(sender->reply);
+
+    sender->reply = dbus_message_ref(reply);
+  }
+}
+
+static void
+parse_method_configs(const gchar *s)
+{
+  gchar **entries = g_strsplit(s, ",", -1);
+  gchar **entry;
+
+  for (entry = entries; *entry; entry++)
+  {
+    gchar **fields = g_strsplit(g_strstrip(*entry), ":", 3);
+
+    if (g_strv_length(fields) == 3 && *fields[0])
+    {
+      ratelimit_config_t *config = g_new(ratelimit_config_t, 1);
+
+      config->rate = atoi(fields[1]);
+      config->burst = MAX(atoi(fields[2]), 1);
+      g_hash_table_replace(method_configs, g_strdup(fields[0]), config);
+    }
+    else
+      SYSTEMUI_WARNING("Invalid rate limit entry '%s'", *entry);
+
+    g_strfreev(fields);
+  }
+
+  g_strfreev(entries);
+}
+
+static void
+ratelimit_load_config(system_ui_data *ui)
+{
+  gchar *methods;
+
+  default_config.rate = settings_get_int(ui, SYSTEMUI_GCONF_RATELIMIT_RATE,
+                                         RATELIMIT_DEFAULT_RATE);
+  default_config.burst =
+      MAX(settings_get_int(ui, SYSTEMUI_GCONF_RATELIMIT_BURST,
+                           RATELIMIT_DEFAULT_BURST), 1);
+  coalesce_usecs =
+      (gint64)settings_get_int(ui, SYSTEMUI_GCONF_RATELIMIT_COALESCE,
+                               RATELIMIT_DEFAULT_COALESCE_MS) * 1000;
+
+  methods = settings_get_string(ui, SYSTEMUI_GCONF_RATELIMIT_METHODS);
+
+  if (methods)
+  {
+    parse_method_configs(methods);
+    g_free(methods);
+  }
+}
+
+/* senders are dropped as well, their buckets start over at the new burst */
+static gboolean
+ratelimit_reload(gpointer user_data)
+{
+  reload_id = 0;
+  g_hash_table_remove_all(method_configs);
+  g_hash_table_remove_all(senders);
+  ratelimit_load_config(user_data);
+
+  return FALSE;
+}
+
+/* a new snapshot reports each changed key on its own, reload once for all */
+static void
+ratelimit_config_changed(system_ui_data *ui, const char *key,
+                         gpointer user_data)
+{
+  if (!reload_id)
+    reload_id = g_idle_add(ratelimit_reload, ui);
+}
+
+gboolean
+ratelimit_init(system_ui_data *ui)
+{
+  method_configs = g_hash_table_new_full(method_hash, method_equal, g_free,
+                                         g_free);
+  senders = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, sender_free);
+  ratelimit_load_config(ui);
+  config_notify_id = settings_notify_add(SYSTEMUI_GCONF_RATELIMIT_DIR,
+                                         ratelimit_config_changed, NULL);
+
+  return TRUE;
+}
+
+void
+ratelimit_finish(system_ui_data *ui)
+{
+  settings_notify_remove(config_notify_id);
+  config_notify_id = 0;
+
+  if (reload_id)
+  {
+    g_source_remove(reload_id);
+    reload_id = 0;
+  }
+
+  g_hash_table_destroy(senders);
+  senders = NULL;
+
+  g_hash_table_destroy(method_configs);
+  method_configs = NULL;
+}
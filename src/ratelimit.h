@@ -0,0 +1,36 @@
+#ifndef SYSTEMUI_RATELIMIT_H
+#define SYSTEMUI_RATELIMIT_H
+
+#define SYSTEMUI_GCONF_RATELIMIT_DIR SYSTEMUI_GCONF_DIR "ratelimit/"
+/* requests per second per sender and method, 0, the default, disables
+ * limiting. Classes at or above DISPATCH_CRITICAL_CLASS_NAME are exempt */
+#define SYSTEMUI_GCONF_RATELIMIT_RATE SYSTEMUI_GCONF_RATELIMIT_DIR "rate"
+#define SYSTEMUI_GCONF_RATELIMIT_BURST SYSTEMUI_GCONF_RATELIMIT_DIR "burst"
+/* a request identical to the sender's previous one, with no other call in
+ * between, is answered with the last reply within that many ms. 0, the
+ * default, disables this */
+#define SYSTEMUI_GCONF_RATELIMIT_COALESCE SYSTEMUI_GCONF_RATELIMIT_DIR "coalesce_ms"
+/* "method:rate:burst,method:rate:burst..." per method overrides */
+#define SYSTEMUI_GCONF_RATELIMIT_METHODS SYSTEMUI_GCONF_RATELIMIT_DIR "methods"
+
+enum ratelimit_result
+{
+  RATELIMIT_PASS,
+  RATELIMIT_REJECT,
+  RATELIMIT_COALESCED
+};
+typedef enum ratelimit_result ratelimit_result_t;
+
+/* method is the registered handler name, see handler_get_name(), unknown
+ * methods must be rejected before. On RATELIMIT_COALESCED, *reply is set to
+ * a reply ready to be sent, if any */
+ratelimit_result_t ratelimit_check(DBusMessage *msg, const char *method,
+                                   DBusMessage **reply);
+/* takes a token for a call made on behalf of msg, FALSE if over the limit */
+gboolean ratelimit_charge(DBusMessage *msg, const char *method);
+void ratelimit_store_reply(DBusMessage *msg, DBusMessage *reply);
+
+gboolean ratelimit_init(system_ui_data *ui);
+void ratelimit_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_RATELIMIT_H
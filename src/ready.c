@@ -0,0 +1,312 @@
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <osso-log.h>
+#include <systemui/dbus-names.h>
+#include <systemui.h>
+
+#include "config.h"
+#include "dbus.h"
+#include "ready.h"
+
+/* not in older libdbus */
+#ifndef DBUS_ERROR_UNKNOWN_INTERFACE
+#define DBUS_ERROR_UNKNOWN_INTERFACE "org.freedesktop.DBus.Error.UnknownInterface"
+#endif
+#ifndef DBUS_ERROR_UNKNOWN_PROPERTY
+#define DBUS_ERROR_UNKNOWN_PROPERTY "org.freedesktop.DBus.Error.UnknownProperty"
+#endif
+
+static const char *stage_names[] =
+{
+  "none",
+  "bus-name",
+  "core",
+  "plugins"
+};
+
+static ready_stage_t stage = READY_STAGE_NONE;
+static int ready_fd = -1;
+
+static void
+ready_write_fd(const char *name)
+{
+  gchar *line = g_strconcat(name, "\n", NULL);
+  ssize_t rv;
+
+  do
+    rv = write(ready_fd, line, strlen(line));
+  while (rv < 0 && errno == EINTR);
+
+  if (rv < 0)
+  {
+    SYSTEMUI_WARNING("Cannot write readiness to fd %d: %s", ready_fd,
+                     strerror(errno));
+  }
+
+  g_free(line);
+}
+
+/* the sd_notify() protocol, without depending on libsystemd */
+static void
+ready_notify_socket(const char *name, gboolean last)
+{
+  const char *path = g_getenv("NOTIFY_SOCKET");
+  struct sockaddr_un addr;
+  gchar *state;
+  int fd;
+
+  if (!path || (path[0] != '/' && path[0] != '@') ||
+      strlen(path) >= sizeof(addr.sun_path))
+  {
+    return;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  /* abstract namespace */
+  if (addr.sun_path[0] == '@')
+    addr.sun_path[0] = 0;
+
+  if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+    return;
+
+  state = g_strdup_printf("%sSTATUS=%s\nX_SYSTEMUI_STAGE=%s",
+                          last ? "READY=1\n" : "", name, name);
+
+  if (sendto(fd, state, strlen(state), MSG_NOSIGNAL, (struct sockaddr *)&addr,
+             offsetof(struct sockaddr_un, sun_path) + strlen(path)) < 0)
+  {
+    SYSTEMUI_WARNING("Cannot notify %s: %s", path, strerror(errno));
+  }
+
+  g_free(state);
+  close(fd);
+
+  /* not for plugins spawning children */
+  if (last)
+    g_unsetenv("NOTIFY_SOCKET");
+}
+
+static void
+ready_send_signal(system_ui_data *ui)
+{
+  DBusMessage *msg;
+  dbus_uint32_t u = stage;
+  const char *name = stage_names[stage];
+
+  if (!ui->system_bus)
+    return;
+
+  msg = dbus_message_new_signal(SYSTEMUI_SIGNAL_PATH, SYSTEMUI_SIGNAL_IF,
+                                SYSTEMUI_READY_SIG);
+
+  if (msg && dbus_message_append_args(msg,
+                                      DBUS_TYPE_UINT32, &u,
+                                      DBUS_TYPE_STRING, &name,
+                                      DBUS_TYPE_INVALID))
+  {
+    dbus_send_message(ui->system_bus, msg);
+  }
+  else if (msg)
+    dbus_message_unref(msg);
+}
+
+void
+ready_set_fd(int fd)
+{
+  ready_fd = fd;
+}
+
+ready_stage_t
+ready_get_stage(void)
+{
+  return stage;
+}
+
+void
+ready_reached(system_ui_data *ui, ready_stage_t new_stage)
+{
+  gboolean last = new_stage == READY_STAGE_PLUGINS;
+
+  if (new_stage <= stage)
+    return;
+
+  stage = new_stage;
+  ULOG_INFO("Ready stage '%s' reached", stage_names[stage]);
+
+  if (ready_fd >= 0)
+  {
+    ready_write_fd(stage_names[stage]);
+
+    if (last)
+    {
+      close(ready_fd);
+      ready_fd = -1;
+    }
+  }
+
+  ready_notify_socket(stage_names[stage], last);
+  ready_send_signal(ui);
+}
+
+static gboolean
+ready_append_property(DBusMessageIter *iter, const char *name)
+{
+  DBusMessageIter var;
+  int type;
+  dbus_uint32_t u = stage;
+  const char *s = stage_names[stage];
+
+  if (!strcmp(name, SYSTEMUI_READY_PROPERTY))
+    type = DBUS_TYPE_UINT32;
+  else if (!strcmp(name, SYSTEMUI_READY_NAME_PROPERTY))
+    type = DBUS_TYPE_STRING;
+  else
+    return FALSE;
+
+  return dbus_message_iter_open_container(
+        iter, DBUS_TYPE_VARIANT,
+        type == DBUS_TYPE_UINT32 ? DBUS_TYPE_UINT32_AS_STRING :
+                                   DBUS_TYPE_STRING_AS_STRING,
+        &var) &&
+      dbus_message_iter_append_basic(&var, type,
+                                     type == DBUS_TYPE_UINT32 ? (void *)&u :
+                                                                (void *)&s) &&
+      dbus_message_iter_close_container(iter, &var);
+}
+
+gboolean
+ready_handle_properties(DBusConnection *connection, DBusMessage *msg,
+                        system_ui_data *ui)
+{
+  const char *iface = NULL;
+  const char *name = NULL;
+  DBusMessage *reply = NULL;
+  DBusMessageIter iter;
+
+  if (strcmp(dbus_message_get_interface(msg), DBUS_INTERFACE_PROPERTIES) ||
+      g_strcmp0(dbus_message_get_path(msg), ui->requestpath))
+  {
+    return FALSE;
+  }
+
+  if (dbus_message_is_method_call(msg, DBUS_INTERFACE_PROPERTIES, "Get") &&
+      dbus_message_get_args(msg, NULL,
+                            DBUS_TYPE_STRING, &iface,
+                            DBUS_TYPE_STRING, &name,
+                            DBUS_TYPE_INVALID))
+  {
+    if (strcmp(iface, ui->requestinterface))
+    {
+      reply = dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_INTERFACE,
+                                            "No such interface '%s'", iface);
+    }
+    else if ((reply = dbus_message_new_method_return(msg)))
+    {
+      dbus_message_iter_init_append(reply, &iter);
+
+      if (!ready_append_property(&iter, name))
+      {
+        dbus_message_unref(reply);
+        reply = dbus_message_new_error_printf(msg, DBUS_ERROR_UNKNOWN_PROPERTY,
+                                              "No such property '%s'", name);
+      }
+    }
+  }
+  else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_PROPERTIES,
+                                       "GetAll") &&
+           dbus_message_get_args(msg, NULL,
+                                 DBUS_TYPE_STRING, &iface,
+                                 DBUS_TYPE_INVALID))
+  {
+    const char *names[] =
+    {
+      SYSTEMUI_READY_PROPERTY,
+      SYSTEMUI_READY_NAME_PROPERTY
+    };
+    DBusMessageIter dict;
+    DBusMessageIter entry;
+    int i;
+
+    if ((reply = dbus_message_new_method_return(msg)))
+    {
+      dbus_message_iter_init_append(reply, &iter);
+      dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}", &dict);
+
+      for (i = 0; !strcmp(iface, ui->requestinterface) &&
+           i < G_N_ELEMENTS(names); i++)
+      {
+        dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL,
+                                         &entry);
+        dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &names[i]);
+        ready_append_property(&entry, names[i]);
+        dbus_message_iter_close_container(&dict, &entry);
+      }
+
+      dbus_message_iter_close_container(&iter, &dict);
+    }
+  }
+  else if (dbus_message_is_method_call(msg, DBUS_INTERFACE_PROPERTIES, "Set"))
+  {
+    reply = dbus_message_new_error(msg, DBUS_ERROR_ACCESS_DENIED,
+                                   "Properties are read-only");
+  }
+  else
+  {
+    reply = dbus_message_new_error(msg, DBUS_ERROR_INVALID_ARGS,
+                                   DBUS_ERROR_INVALID_ARGS);
+  }
+
+  if (dbus_message_get_no_reply(msg))
+  {
+    if (reply)
+      dbus_message_unref(reply);
+  }
+  else if (reply)
+    dbus_send_message(connection, reply);
+
+  return TRUE;
+}
+
+static int
+ready_handler(const char *interface, const char *method, GArray *args,
+              system_ui_data *ui, system_ui_handler_arg *result)
+{
+  dbus_uint32_t u = stage;
+  const char *name = stage_names[stage];
+
+  if (!systemui_reply_append(result,
+                             DBUS_TYPE_UINT32, &u,
+                             DBUS_TYPE_STRING, &name,
+                             DBUS_TYPE_INVALID))
+  {
+    return 0;
+  }
+
+  return SYSTEMUI_REPLY_APPENDED;
+}
+
+gboolean
+ready_init(system_ui_data *ui)
+{
+  return systemui_add_handler_with_signature(SYSTEMUI_READY_REQ, ready_handler,
+                                             "", ui);
+}
+
+void
+ready_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_READY_REQ, ui);
+
+  if (ready_fd >= 0)
+  {
+    close(ready_fd);
+    ready_fd = -1;
+  }
+}
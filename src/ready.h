@@ -0,0 +1,39 @@
+#ifndef SYSTEMUI_READY_H
+#define SYSTEMUI_READY_H
+
+#define SYSTEMUI_READY_REQ "get_ready_stage"
+/* u stage, s stage name */
+#define SYSTEMUI_READY_SIG "ready_stage_changed"
+
+/* org.freedesktop.DBus.Properties on SYSTEMUI_REQUEST_PATH, interface
+ * SYSTEMUI_REQUEST_IF */
+#define SYSTEMUI_READY_PROPERTY "ReadyStage"
+#define SYSTEMUI_READY_NAME_PROPERTY "ReadyStageName"
+
+/*
+ * Stages only ever go up. Each one is announced with SYSTEMUI_READY_SIG, as
+ * "STATUS=" and "X_SYSTEMUI_STAGE=" on $NOTIFY_SOCKET ("READY=1" with the
+ * last one) and as a "<name>\n" line on the --ready-fd descriptor, which
+ * is closed after the last stage.
+ */
+enum ready_stage
+{
+  READY_STAGE_NONE = 0,
+  READY_STAGE_BUS_NAME, /* "bus-name", requests are queued from now on */
+  READY_STAGE_CORE,     /* "core", core handlers are registered */
+  READY_STAGE_PLUGINS   /* "plugins", all plugins are loaded */
+};
+typedef enum ready_stage ready_stage_t;
+
+void ready_set_fd(int fd);
+void ready_reached(system_ui_data *ui, ready_stage_t stage);
+ready_stage_t ready_get_stage(void);
+
+/* TRUE if msg was an org.freedesktop.DBus.Properties call and got answered */
+gboolean ready_handle_properties(DBusConnection *connection, DBusMessage *msg,
+                                 system_ui_data *ui);
+
+gboolean ready_init(system_ui_data *ui);
+void ready_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_READY_H
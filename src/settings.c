@@ -0,0 +1,426 @@
+#include <string.h>
+#include <stdlib.h>
+#include <gio/gio.h>
+#include <systemui.h>
+
+#include "config.h"
+#include "settings.h"
+#include "watch-list.h"
+
+/* full GConf key -> value as string */
+static GHashTable *values = NULL;
+/* data is the key prefix */
+static watch_list_t watches = WATCH_LIST_INIT(g_free);
+static gchar *settings_file = NULL;
+static GFileMonitor *monitor = NULL;
+static system_ui_data *settings_ui = NULL;
+
+#ifdef WITH_GCONF_SETTINGS
+static guint gconf_idle_id = 0;
+static guint gconf_notify_id = 0;
+#endif
+
+static gboolean
+settings_key_split(const char *key, gchar **group, gchar **name)
+{
+  const char *rel;
+  const char *slash;
+
+  if (!g_str_has_prefix(key, SYSTEMUI_GCONF_DIR))
+    return FALSE;
+
+  rel = key + strlen(SYSTEMUI_GCONF_DIR);
+
+  if (!*rel)
+    return FALSE;
+
+  if ((slash = strrchr(rel, '/')))
+  {
+    *group = g_strndup(rel, slash - rel);
+    *name = g_strdup(slash + 1);
+  }
+  else
+  {
+    *group = g_strdup(SYSTEMUI_SETTINGS_DEFAULT_GROUP);
+    *name = g_strdup(rel);
+  }
+
+  return TRUE;
+}
+
+static gchar *
+settings_key_join(const char *group, const char *name)
+{
+  if (!strcmp(group, SYSTEMUI_SETTINGS_DEFAULT_GROUP))
+    return g_strconcat(SYSTEMUI_GCONF_DIR, name, NULL);
+
+  return g_strconcat(SYSTEMUI_GCONF_DIR, group, "/", name, NULL);
+}
+
+static void
+settings_watch_call(watch_t *w, gpointer key)
+{
+  if (g_str_has_prefix(key, w->data))
+    ((settings_notify_func)w->func)(settings_ui, key, w->user_data);
+}
+
+/* takes value, NULL unsets key. Returns TRUE if that changed anything */
+static gboolean
+settings_set(const char *key, gchar *value)
+{
+  const gchar *old = g_hash_table_lookup(values, key);
+
+  if (!g_strcmp0(old, value))
+  {
+    g_free(value);
+    return FALSE;
+  }
+
+  if (value)
+    g_hash_table_replace(values, g_strdup(key), value);
+  else
+    g_hash_table_remove(values, key);
+
+  watch_list_call(&watches, settings_watch_call, (gpointer)key);
+
+  return TRUE;
+}
+
+static GKeyFile *
+settings_to_key_file(void)
+{
+  GKeyFile *kf = g_key_file_new();
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  g_hash_table_iter_init(&iter, values);
+
+  while (g_hash_table_iter_next(&iter, &key, &value))
+  {
+    gchar *group;
+    gchar *name;
+
+    if (settings_key_split(key, &group, &name))
+    {
+      g_key_file_set_value(kf, group, name, value);
+      g_free(group);
+      g_free(name);
+    }
+  }
+
+  return kf;
+}
+
+static void
+settings_save(void)
+{
+  GKeyFile *kf = settings_to_key_file();
+  gchar *dir = g_path_get_dirname(settings_file);
+  gchar *data;
+  gsize len;
+  GError *error = NULL;
+
+  data = g_key_file_to_data(kf, &len, NULL);
+  g_mkdir_with_parents(dir, 0700);
+
+  if (!g_file_set_contents(settings_file, data, len, &error))
+  {
+    SYSTEMUI_NOTICE("Cannot write settings snapshot %s: %s", settings_file,
+                    error->message);
+    g_error_free(error);
+  }
+
+  g_free(data);
+  g_free(dir);
+  g_key_file_free(kf);
+}
+
+/* replaces all values with what is in the snapshot, FALSE if unreadable */
+static gboolean
+settings_load(void)
+{
+  GKeyFile *kf = g_key_file_new();
+  GHashTable *seen;
+  GHashTableIter iter;
+  gpointer key;
+  gchar **groups;
+  gchar **group;
+  GSList *removed = NULL;
+  GSList *l;
+
+  if (!g_key_file_load_from_file(kf, settings_file, G_KEY_FILE_NONE, NULL))
+  {
+    g_key_file_free(kf);
+    return FALSE;
+  }
+
+  seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  groups = g_key_file_get_groups(kf, NULL);
+
+  for (group = groups; *group; group++)
+  {
+    gchar **names = g_key_file_get_keys(kf, *group, NULL, NULL);
+    gchar **name;
+
+    for (name = names; name && *name; name++)
+    {
+      gchar *full = settings_key_join(*group, *name);
+
+      settings_set(full, g_key_file_get_value(kf, *group, *name, NULL));
+      g_hash_table_add(seen, full);
+    }
+
+    g_strfreev(names);
+  }
+
+  g_strfreev(groups);
+  g_key_file_free(kf);
+
+  g_hash_table_iter_init(&iter, values);
+
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+  {
+    if (!g_hash_table_contains(seen, key))
+      removed = g_slist_prepend(removed, g_strdup(key));
+  }
+
+  for (l = removed; l; l = l->next)
+    settings_set(l->data, NULL);
+
+  g_slist_free_full(removed, g_free);
+  g_hash_table_destroy(seen);
+
+  return TRUE;
+}
+
+static void
+settings_file_changed(GFileMonitor *monitor, GFile *file, GFile *other,
+                      GFileMonitorEvent event, gpointer user_data)
+{
+  if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT ||
+      event == G_FILE_MONITOR_EVENT_CREATED)
+  {
+    settings_load();
+  }
+}
+
+#ifdef WITH_GCONF_SETTINGS
+static gchar *
+settings_gconf_value_string(const GConfValue *value)
+{
+  switch (value->type)
+  {
+    case GCONF_VALUE_STRING:
+      return g_strdup(gconf_value_get_string(value));
+    case GCONF_VALUE_INT:
+      return g_strdup_printf("%d", gconf_value_get_int(value));
+    /* read back with settings_get_int() like the switches in the file */
+    case GCONF_VALUE_BOOL:
+      return g_strdup(gconf_value_get_bool(value) ? "1" : "0");
+    default:
+      return NULL;
+  }
+}
+
+/* one recursive sweep, returns TRUE if a value changed */
+static gboolean
+settings_gconf_read(GConfClient *client, const char *dir)
+{
+  GSList *entries = gconf_client_all_entries(client, dir, NULL);
+  GSList *dirs = gconf_client_all_dirs(client, dir, NULL);
+  gboolean changed = FALSE;
+  GSList *l;
+
+  for (l = entries; l; l = l->next)
+  {
+    GConfEntry *entry = l->data;
+    GConfValue *value = gconf_entry_get_value(entry);
+
+    if (value)
+    {
+      changed |= settings_set(gconf_entry_get_key(entry),
+                              settings_gconf_value_string(value));
+    }
+
+    gconf_entry_free(entry);
+  }
+
+  for (l = dirs; l; l = l->next)
+  {
+    changed |= settings_gconf_read(client, l->data);
+    g_free(l->data);
+  }
+
+  g_slist_free(entries);
+  g_slist_free(dirs);
+
+  return changed;
+}
+
+static void
+settings_gconf_changed(GConfClient *client, guint id, GConfEntry *entry,
+                       gpointer user_data)
+{
+  GConfValue *value = gconf_entry_get_value(entry);
+
+  if (settings_set(gconf_entry_get_key(entry),
+                   value ? settings_gconf_value_string(value) : NULL))
+  {
+    settings_save();
+  }
+}
+
+static gboolean
+settings_gconf_connect(gpointer user_data)
+{
+  system_ui_data *ui = user_data;
+  /* trailing slash is not a valid GConf dir */
+  gchar *dir = g_strndup(SYSTEMUI_GCONF_DIR, strlen(SYSTEMUI_GCONF_DIR) - 1);
+
+  gconf_idle_id = 0;
+  gconf_client_add_dir(ui->gc_client, dir, GCONF_CLIENT_PRELOAD_NONE, NULL);
+  gconf_notify_id = gconf_client_notify_add(ui->gc_client, dir,
+                                            settings_gconf_changed, NULL,
+                                            NULL, NULL);
+
+  if (settings_gconf_read(ui->gc_client, dir))
+    settings_save();
+
+  g_free(dir);
+
+  return FALSE;
+}
+#endif
+
+gint
+settings_get_int(system_ui_data *ui, const char *key, gint def)
+{
+  const gchar *s = values ? g_hash_table_lookup(values, key) : NULL;
+  gchar *end;
+  gint64 v;
+
+  if (!s)
+    return def;
+
+  /* snapshots taken from GConf before bools were imported as 0/1 */
+  if (!g_ascii_strcasecmp(s, "true"))
+    return 1;
+
+  if (!g_ascii_strcasecmp(s, "false"))
+    return 0;
+
+  v = g_ascii_strtoll(s, &end, 10);
+
+  if (end == s || *end || v < G_MININT || v > G_MAXINT)
+  {
+    SYSTEMUI_WARNING("Setting %s is not an integer: '%s'", key, s);
+    return def;
+  }
+
+  return v;
+}
+
+gchar *
+settings_get_string(system_ui_data *ui, const char *key)
+{
+  return values ? g_strdup(g_hash_table_lookup(values, key)) : NULL;
+}
+
+guint
+settings_notify_add(const char *prefix, settings_notify_func func,
+                    gpointer user_data)
+{
+  return watch_list_add(&watches, G_CALLBACK(func), g_strdup(prefix),
+                        user_data);
+}
+
+void
+settings_notify_remove(guint id)
+{
+  watch_list_remove(&watches, id);
+}
+
+gboolean
+settings_init(system_ui_data *ui, const char *file)
+{
+  GFile *f;
+  gboolean loaded;
+
+  settings_ui = ui;
+  settings_file = file ? g_strdup(file) :
+                         g_build_filename(g_get_user_cache_dir(),
+                                          SYSTEMUI_SETTINGS_DIR,
+                                          SYSTEMUI_SETTINGS_FILE, NULL);
+  values = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  loaded = settings_load();
+
+#ifdef WITH_GCONF_SETTINGS
+  if (ui->gc_client)
+  {
+    if (!loaded)
+    {
+      /* first boot, GConf is the only source */
+      SYSTEMUI_INFO("No settings snapshot %s, reading GConf", settings_file);
+      settings_gconf_connect(ui);
+    }
+    else
+    {
+      gconf_idle_id = g_idle_add_full(G_PRIORITY_LOW, settings_gconf_connect,
+                                      ui, NULL);
+    }
+  }
+#else
+  if (!loaded)
+    SYSTEMUI_INFO("No settings snapshot %s, using defaults", settings_file);
+#endif
+
+  f = g_file_new_for_path(settings_file);
+  monitor = g_file_monitor_file(f, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref(f);
+
+  if (monitor)
+  {
+    g_signal_connect(monitor, "changed", G_CALLBACK(settings_file_changed),
+                     NULL);
+  }
+
+  return TRUE;
+}
+
+void
+settings_finish(system_ui_data *ui)
+{
+#ifdef WITH_GCONF_SETTINGS
+  if (gconf_idle_id)
+  {
+    g_source_remove(gconf_idle_id);
+    gconf_idle_id = 0;
+  }
+
+  if (gconf_notify_id)
+  {
+    gchar *dir = g_strndup(SYSTEMUI_GCONF_DIR,
+                           strlen(SYSTEMUI_GCONF_DIR) - 1);
+
+    gconf_client_notify_remove(ui->gc_client, gconf_notify_id);
+    gconf_client_remove_dir(ui->gc_client, dir, NULL);
+    gconf_notify_id = 0;
+    g_free(dir);
+  }
+#endif
+
+  if (monitor)
+  {
+    g_object_unref(monitor);
+    monitor = NULL;
+  }
+
+  watch_list_clear(&watches);
+
+  g_hash_table_destroy(values);
+  values = NULL;
+  g_free(settings_file);
+  settings_file = NULL;
+  settings_ui = NULL;
+}
@@ -0,0 +1,35 @@
+#ifndef SYSTEMUI_SETTINGS_H
+#define SYSTEMUI_SETTINGS_H
+
+/*
+ * Settings are read from a key file snapshot at startup. Keys keep their
+ * GConf names, /system/systemui/ratelimit/rate is "rate" in group
+ * [ratelimit], keys directly under /system/systemui/ are in [systemui].
+ *
+ * With the GConf backend the snapshot is refreshed from GConf once the main
+ * loop runs, GConf changes are written back to it. Without a snapshot GConf
+ * is read synchronously once to create it.
+ */
+/* systemui runs as the session user, the snapshot is kept below its cache
+ * directory. The directory is private, trace dumps go there too */
+#define SYSTEMUI_SETTINGS_DIR "systemui"
+#define SYSTEMUI_SETTINGS_FILE "settings.ini"
+#define SYSTEMUI_SETTINGS_DEFAULT_GROUP "systemui"
+
+typedef void (*settings_notify_func)(system_ui_data *ui, const char *key,
+                                     gpointer user_data);
+
+gint settings_get_int(system_ui_data *ui, const char *key, gint def);
+/* returned string must be g_free()d, NULL if the key is not set */
+gchar *settings_get_string(system_ui_data *ui, const char *key);
+
+/* func is called for every changed key starting with prefix */
+guint settings_notify_add(const char *prefix, settings_notify_func func,
+                          gpointer user_data);
+void settings_notify_remove(guint id);
+
+/* file NULL for SYSTEMUI_SETTINGS_FILE in SYSTEMUI_SETTINGS_DIR */
+gboolean settings_init(system_ui_data *ui, const char *file);
+void settings_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_SETTINGS_H
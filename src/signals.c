@@ -0,0 +1,328 @@
+#include <stdarg.h>
+#include <string.h>
+#include <systemui.h>
+
+#include "dbus.h"
+#include "dispatch.h"
+#include "signals.h"
+
+/* how long emissions are collected before they go out */
+#define SIGNALS_FLUSH_MS 10
+
+struct signal_pending
+{
+  gchar *id;
+  DBusMessage *msg;
+};
+typedef struct signal_pending signal_pending_t;
+
+struct signal_property
+{
+  int type;
+  DBusBasicValue value;
+};
+typedef struct signal_property signal_property_t;
+
+/* "member\nkey" -> signal_pending_t */
+static GHashTable *pending = NULL;
+/* signal_pending_t, in the order they were first queued */
+static GQueue order = G_QUEUE_INIT;
+/* name -> signal_property_t */
+static GHashTable *properties = NULL;
+
+static system_ui_data *flush_ui = NULL;
+static guint flush_id = 0;
+
+static struct
+{
+  guint queued;
+  guint sent;
+  guint coalesced;
+  guint properties;
+} stats;
+
+static void
+signal_pending_free(signal_pending_t *sig)
+{
+  if (sig->msg)
+    dbus_message_unref(sig->msg);
+
+  g_free(sig->id);
+  g_free(sig);
+}
+
+static void
+signal_property_free(signal_property_t *prop)
+{
+  if (!dbus_type_is_fixed(prop->type))
+    g_free(prop->value.str);
+
+  g_free(prop);
+}
+
+static void
+signals_send(system_ui_data *ui, DBusMessage *msg)
+{
+  if (dbus_send_message(ui->system_bus, msg))
+    stats.sent++;
+}
+
+static gsize
+signal_type_size(int type)
+{
+  switch (type)
+  {
+    case DBUS_TYPE_BYTE:
+      return 1;
+    case DBUS_TYPE_INT16:
+    case DBUS_TYPE_UINT16:
+      return 2;
+    case DBUS_TYPE_INT64:
+    case DBUS_TYPE_UINT64:
+    case DBUS_TYPE_DOUBLE:
+      return 8;
+    case DBUS_TYPE_BOOLEAN:
+      return sizeof(dbus_bool_t);
+    default:
+      return 4;
+  }
+}
+
+static DBusMessage *
+signals_properties_message(system_ui_data *ui)
+{
+  DBusMessage *msg;
+  DBusMessageIter iter;
+  DBusMessageIter dict;
+  GHashTableIter props;
+  gpointer name;
+  gpointer value;
+
+  msg = dbus_message_new_signal(ui->signalpath, ui->signalinterface,
+                                SYSTEMUI_PROPERTIES_SIG);
+
+  if (!msg)
+    return NULL;
+
+  dbus_message_iter_init_append(msg, &iter);
+
+  if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}",
+                                        &dict))
+  {
+    goto err;
+  }
+
+  g_hash_table_iter_init(&props, properties);
+
+  while (g_hash_table_iter_next(&props, &name, &value))
+  {
+    signal_property_t *prop = value;
+    DBusMessageIter entry;
+    DBusMessageIter var;
+    char sig[2] = {prop->type, 0};
+
+    if (!dbus_message_iter_open_container(&dict, DBUS_TYPE_DICT_ENTRY, NULL,
+                                          &entry) ||
+        !dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &name) ||
+        !dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT, sig,
+                                          &var) ||
+        !dbus_message_iter_append_basic(&var, prop->type, &prop->value) ||
+        !dbus_message_iter_close_container(&entry, &var) ||
+        !dbus_message_iter_close_container(&dict, &entry))
+    {
+      goto err;
+    }
+  }
+
+  if (dbus_message_iter_close_container(&iter, &dict))
+    return msg;
+
+err:
+  SYSTEMUI_WARNING("Cannot build %s signal", SYSTEMUI_PROPERTIES_SIG);
+  dbus_message_unref(msg);
+
+  return NULL;
+}
+
+static void
+signals_flush(system_ui_data *ui)
+{
+  signal_pending_t *sig;
+
+  while ((sig = g_queue_pop_head(&order)))
+  {
+    signals_send(ui, sig->msg);
+    sig->msg = NULL;
+    g_hash_table_remove(pending, sig->id);
+  }
+
+  if (properties && g_hash_table_size(properties))
+  {
+    DBusMessage *msg = signals_properties_message(ui);
+
+    if (msg)
+      signals_send(ui, msg);
+
+    g_hash_table_remove_all(properties);
+  }
+}
+
+static gboolean
+signals_flush_timeout(gpointer user_data)
+{
+  flush_id = 0;
+  signals_flush(user_data);
+
+  return FALSE;
+}
+
+/* everything queued within SIGNALS_FLUSH_MS goes out at once. An idle would
+ * be starved by the dispatch queues under load, at their priority it is
+ * not */
+static void
+signals_schedule(system_ui_data *ui)
+{
+  flush_ui = ui;
+
+  if (!flush_id)
+  {
+    flush_id = g_timeout_add_full(dispatch_get_priority(), SIGNALS_FLUSH_MS,
+                                  signals_flush_timeout, ui, NULL);
+  }
+}
+
+gboolean
+systemui_signal_emit(system_ui_data *ui, const char *member, const char *key,
+                     int first_arg_type, ...)
+{
+  signal_pending_t *sig;
+  DBusMessage *msg;
+  gchar *id;
+  va_list ap;
+  dbus_bool_t rv;
+
+  g_return_val_if_fail(ui != NULL && member != NULL, FALSE);
+
+  msg = dbus_message_new_signal(ui->signalpath, ui->signalinterface, member);
+
+  if (!msg)
+    return FALSE;
+
+  va_start(ap, first_arg_type);
+  rv = dbus_message_append_args_valist(msg, first_arg_type, ap);
+  va_end(ap);
+
+  if (!rv)
+  {
+    SYSTEMUI_WARNING("Cannot append %s signal arguments", member);
+    dbus_message_unref(msg);
+
+    return FALSE;
+  }
+
+  if (!pending)
+  {
+    pending = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                    (GDestroyNotify)signal_pending_free);
+  }
+
+  id = g_strconcat(member, "\n", key ? key : "", NULL);
+  stats.queued++;
+
+  /* keeps its place in the queue, only the arguments are replaced */
+  if ((sig = g_hash_table_lookup(pending, id)))
+  {
+    g_free(id);
+    dbus_message_unref(sig->msg);
+    sig->msg = msg;
+    stats.coalesced++;
+
+    return TRUE;
+  }
+
+  sig = g_new(signal_pending_t, 1);
+  sig->id = id;
+  sig->msg = msg;
+  g_hash_table_insert(pending, id, sig);
+  g_queue_push_tail(&order, sig);
+  signals_schedule(ui);
+
+  return TRUE;
+}
+
+gboolean
+systemui_signal_property(system_ui_data *ui, const char *name, int type,
+                         const void *value)
+{
+  signal_property_t *prop;
+
+  g_return_val_if_fail(ui != NULL && name != NULL && value != NULL, FALSE);
+  g_return_val_if_fail(dbus_type_is_basic(type), FALSE);
+
+  if (!properties)
+  {
+    properties = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       (GDestroyNotify)signal_property_free);
+  }
+
+  prop = g_new0(signal_property_t, 1);
+  prop->type = type;
+
+  if (dbus_type_is_fixed(type))
+    memcpy(&prop->value, value, signal_type_size(type));
+  else
+    prop->value.str = g_strdup(*(const char *const *)value);
+
+  stats.properties++;
+
+  if (g_hash_table_lookup(properties, name))
+    stats.coalesced++;
+
+  g_hash_table_replace(properties, g_strdup(name), prop);
+  signals_schedule(ui);
+
+  return TRUE;
+}
+
+void
+signals_print_stats(GString *s)
+{
+  g_string_append_printf(
+        s, "signals queued=%u properties=%u coalesced=%u sent=%u "
+        "pending=%u\n", stats.queued, stats.properties, stats.coalesced,
+        stats.sent, g_queue_get_length(&order));
+}
+
+void
+signals_reset_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+}
+
+void
+signals_finish(system_ui_data *ui)
+{
+  if (flush_id)
+  {
+    g_source_remove(flush_id);
+    flush_id = 0;
+  }
+
+  /* still connected, listeners get the final values */
+  if (flush_ui)
+    signals_flush(flush_ui);
+
+  flush_ui = NULL;
+
+  if (pending)
+  {
+    g_hash_table_destroy(pending);
+    pending = NULL;
+  }
+
+  if (properties)
+  {
+    g_hash_table_destroy(properties);
+    properties = NULL;
+  }
+}
@@ -0,0 +1,10 @@
+#ifndef SYSTEMUI_SIGNALS_H
+#define SYSTEMUI_SIGNALS_H
+
+void signals_print_stats(GString *s);
+void signals_reset_stats(void);
+
+/* sends whatever is still pending */
+void signals_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_SIGNALS_H
@@ -0,0 +1,360 @@
+#include <string.h>
+#include <systemui.h>
+
+#include "dbus.h"
+#include "icons.h"
+#include "plugin.h"
+#include "signals.h"
+#include "stats.h"
+#include "wakeup.h"
+#include "watchdog.h"
+
+struct method_stats
+{
+  volatile gint calls;
+  volatile gint failures;
+  stats_histogram_t latency;
+};
+typedef struct method_stats method_stats_t;
+
+static struct
+{
+  volatile gint method_calls;
+  volatile gint unknown_methods;
+  volatile gint invalid_interface;
+  volatile gint bad_signature;
+  volatile gint signals;
+  volatile gint replies_failed;
+  volatile gint rate_limited;
+  volatile gint coalesced;
+  volatile gint queue_max;
+  volatile gint messages_sent;
+  volatile gint send_failures;
+  volatile gint outgoing_max;
+  volatile gint ipm_shows;
+  volatile gint ipm_hides;
+  volatile gint ipm_depth;
+  volatile gint ipm_depth_max;
+  volatile gint ipm_occlusions;
+  volatile gint ipm_occluded;
+  volatile gint plugins_loaded;
+  volatile gint plugins_failed;
+  stats_histogram_t plugin_load;
+  stats_histogram_t queue_wait;
+} stats;
+
+/* registered handler name -> method_stats_t, only known handlers get an
+ * entry and case variants of their names share it, so a client can't grow
+ * the table by calling random names */
+static GHashTable *method_stats = NULL;
+
+static void
+stats_atomic_max(volatile gint *max, gint val)
+{
+  gint old;
+
+  do
+  {
+    old = g_atomic_int_get(max);
+
+    if (val <= old)
+      return;
+  }
+  while (!g_atomic_int_compare_and_exchange(max, old, val));
+}
+
+void
+stats_histogram_add(stats_histogram_t *hist, gint64 usecs)
+{
+  guint bucket = 0;
+  gint64 v;
+
+  if (usecs < 0)
+    usecs = 0;
+
+  for (v = usecs; v > 1 && bucket < STATS_HISTOGRAM_BUCKETS - 1; v >>= 1)
+    bucket++;
+
+  g_atomic_int_inc(&hist->count);
+  g_atomic_int_inc(&hist->buckets[bucket]);
+  stats_atomic_max(&hist->max, usecs > G_MAXINT ? G_MAXINT : (gint)usecs);
+}
+
+void
+stats_histogram_reset(stats_histogram_t *hist)
+{
+  int i;
+
+  g_atomic_int_set(&hist->count, 0);
+  g_atomic_int_set(&hist->max, 0);
+
+  for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++)
+    g_atomic_int_set(&hist->buckets[i], 0);
+}
+
+void
+stats_histogram_print(GString *s, const char *name, stats_histogram_t *hist)
+{
+  int last = STATS_HISTOGRAM_BUCKETS - 1;
+  int i;
+
+  /* trailing empty buckets are noise */
+  while (last > 0 && !g_atomic_int_get(&hist->buckets[last]))
+    last--;
+
+  g_string_append_printf(s, "%s count=%d max_us=%d hist_log2_us=", name,
+                         g_atomic_int_get(&hist->count),
+                         g_atomic_int_get(&hist->max));
+
+  for (i = 0; i <= last; i++)
+  {
+    g_string_append_printf(s, i ? ",%d" : "%d",
+                           g_atomic_int_get(&hist->buckets[i]));
+  }
+
+  g_string_append_c(s, '\n');
+}
+
+static method_stats_t *
+method_stats_get(const char *method)
+{
+  method_stats_t *ms = g_hash_table_lookup(method_stats, method);
+
+  if (!ms)
+  {
+    ms = g_new0(method_stats_t, 1);
+    g_hash_table_insert(method_stats, g_strdup(method), ms);
+  }
+
+  return ms;
+}
+
+void
+stats_method_call(const char *method, gboolean known, int result_type,
+                  gint64 usecs)
+{
+  method_stats_t *ms;
+
+  g_atomic_int_inc(&stats.method_calls);
+
+  if (!known || !method_stats)
+  {
+    g_atomic_int_inc(&stats.unknown_methods);
+    return;
+  }
+
+  ms = method_stats_get(method);
+  g_atomic_int_inc(&ms->calls);
+
+  if (!result_type || result_type == 'm')
+    g_atomic_int_inc(&ms->failures);
+
+  stats_histogram_add(&ms->latency, usecs);
+}
+
+void
+stats_invalid_interface(void)
+{
+  g_atomic_int_inc(&stats.invalid_interface);
+}
+
+void
+stats_bad_signature(void)
+{
+  g_atomic_int_inc(&stats.method_calls);
+  g_atomic_int_inc(&stats.bad_signature);
+}
+
+void
+stats_signal(void)
+{
+  g_atomic_int_inc(&stats.signals);
+}
+
+void
+stats_reply_failed(void)
+{
+  g_atomic_int_inc(&stats.replies_failed);
+}
+
+void
+stats_rate_limited(gboolean coalesced)
+{
+  g_atomic_int_inc(coalesced ? &stats.coalesced : &stats.rate_limited);
+}
+
+void
+stats_dispatch_queued(guint depth)
+{
+  stats_atomic_max(&stats.queue_max, depth);
+}
+
+void
+stats_dispatch_wait(gint64 usecs)
+{
+  stats_histogram_add(&stats.queue_wait, usecs);
+}
+
+void
+stats_message_sent(DBusConnection *dbus, gboolean ok)
+{
+  if (!ok)
+  {
+    g_atomic_int_inc(&stats.send_failures);
+    return;
+  }
+
+  g_atomic_int_inc(&stats.messages_sent);
+
+  if (dbus)
+    stats_atomic_max(&stats.outgoing_max,
+                     dbus_connection_get_outgoing_size(dbus));
+}
+
+void
+stats_ipm_changed(gboolean show, guint depth)
+{
+  g_atomic_int_inc(show ? &stats.ipm_shows : &stats.ipm_hides);
+  g_atomic_int_set(&stats.ipm_depth, depth);
+  stats_atomic_max(&stats.ipm_depth_max, depth);
+}
+
+void
+stats_ipm_occluded(guint unmapped, guint occluded)
+{
+  g_atomic_int_add(&stats.ipm_occlusions, unmapped);
+  g_atomic_int_set(&stats.ipm_occluded, occluded);
+}
+
+void
+stats_plugin_loaded(gboolean ok, gint64 usecs)
+{
+  g_atomic_int_inc(ok ? &stats.plugins_loaded : &stats.plugins_failed);
+  stats_histogram_add(&stats.plugin_load, usecs);
+}
+
+static void
+method_stats_print(gpointer key, gpointer value, gpointer user_data)
+{
+  method_stats_t *ms = value;
+  GString *s = user_data;
+  gchar *name = g_strdup_printf("method %s calls=%d failures=%d latency",
+                                (const char *)key,
+                                g_atomic_int_get(&ms->calls),
+                                g_atomic_int_get(&ms->failures));
+
+  stats_histogram_print(s, name, &ms->latency);
+  g_free(name);
+}
+
+static void
+method_stats_reset(gpointer key, gpointer value, gpointer user_data)
+{
+  method_stats_t *ms = value;
+
+  g_atomic_int_set(&ms->calls, 0);
+  g_atomic_int_set(&ms->failures, 0);
+  stats_histogram_reset(&ms->latency);
+}
+
+static int
+stats_handler(const char *interface, const char *method, GArray *args,
+              system_ui_data *ui, system_ui_handler_arg *result)
+{
+  GString *s = g_string_sized_new(1024);
+
+  g_string_append_printf(
+        s,
+        "dispatch method_calls=%d unknown_methods=%d invalid_interface=%d "
+        "bad_signature=%d signals=%d replies_failed=%d rate_limited=%d "
+        "coalesced=%d\n",
+        g_atomic_int_get(&stats.method_calls),
+        g_atomic_int_get(&stats.unknown_methods),
+        g_atomic_int_get(&stats.invalid_interface),
+        g_atomic_int_get(&stats.bad_signature),
+        g_atomic_int_get(&stats.signals),
+        g_atomic_int_get(&stats.replies_failed),
+        g_atomic_int_get(&stats.rate_limited),
+        g_atomic_int_get(&stats.coalesced));
+  g_string_append_printf(s, "queue depth_max=%d ",
+                         g_atomic_int_get(&stats.queue_max));
+  stats_histogram_print(s, "wait", &stats.queue_wait);
+  g_string_append_printf(
+        s, "send messages=%d failures=%d outgoing_max_bytes=%d\n",
+        g_atomic_int_get(&stats.messages_sent),
+        g_atomic_int_get(&stats.send_failures),
+        g_atomic_int_get(&stats.outgoing_max));
+  g_string_append_printf(
+        s, "ipm shows=%d hides=%d depth=%d depth_max=%d occlusions=%d "
+        "occluded=%d\n",
+        g_atomic_int_get(&stats.ipm_shows),
+        g_atomic_int_get(&stats.ipm_hides),
+        g_atomic_int_get(&stats.ipm_depth),
+        g_atomic_int_get(&stats.ipm_depth_max),
+        g_atomic_int_get(&stats.ipm_occlusions),
+        g_atomic_int_get(&stats.ipm_occluded));
+  g_string_append_printf(
+        s, "plugins loaded=%d failed=%d ",
+        g_atomic_int_get(&stats.plugins_loaded),
+        g_atomic_int_get(&stats.plugins_failed));
+  stats_histogram_print(s, "load", &stats.plugin_load);
+  plugin_print_stats(s);
+  icons_print_stats(s);
+  signals_print_stats(s);
+  g_hash_table_foreach(method_stats, method_stats_print, s);
+
+  return dbus_reply_string(result, g_string_free(s, FALSE));
+}
+
+static int
+stats_reset_handler(const char *interface, const char *method, GArray *args,
+                    system_ui_data *ui, system_ui_handler_arg *result)
+{
+  g_atomic_int_set(&stats.method_calls, 0);
+  g_atomic_int_set(&stats.unknown_methods, 0);
+  g_atomic_int_set(&stats.invalid_interface, 0);
+  g_atomic_int_set(&stats.bad_signature, 0);
+  g_atomic_int_set(&stats.signals, 0);
+  g_atomic_int_set(&stats.replies_failed, 0);
+  g_atomic_int_set(&stats.rate_limited, 0);
+  g_atomic_int_set(&stats.coalesced, 0);
+  g_atomic_int_set(&stats.queue_max, 0);
+  stats_histogram_reset(&stats.queue_wait);
+  g_atomic_int_set(&stats.messages_sent, 0);
+  g_atomic_int_set(&stats.send_failures, 0);
+  g_atomic_int_set(&stats.outgoing_max, 0);
+  g_atomic_int_set(&stats.ipm_shows, 0);
+  g_atomic_int_set(&stats.ipm_hides, 0);
+  /* ipm_depth is a gauge, not a counter */
+  g_atomic_int_set(&stats.ipm_depth_max, g_atomic_int_get(&stats.ipm_depth));
+  g_atomic_int_set(&stats.ipm_occlusions, 0);
+
+  /* plugin load figures are only produced once, at startup, keep them */
+  plugin_reset_stats();
+  icons_reset_stats();
+  signals_reset_stats();
+  wakeup_reset_stats();
+  watchdog_reset_stats();
+  g_hash_table_foreach(method_stats, method_stats_reset, NULL);
+
+  return DBUS_TYPE_VARIANT;
+}
+
+gboolean
+stats_init(system_ui_data *ui)
+{
+  method_stats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  return systemui_add_handler(SYSTEMUI_STATS_REQ, stats_handler, ui) &&
+      systemui_add_handler(SYSTEMUI_STATS_RESET_REQ, stats_reset_handler, ui);
+}
+
+void
+stats_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_STATS_RESET_REQ, ui);
+  systemui_remove_handler(SYSTEMUI_STATS_REQ, ui);
+
+  g_hash_table_destroy(method_stats);
+  method_stats = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef SYSTEMUI_STATS_H
+#define SYSTEMUI_STATS_H
+
+#define SYSTEMUI_STATS_REQ "get_stats"
+#define SYSTEMUI_STATS_RESET_REQ "reset_stats"
+
+/* log2 buckets in microseconds, last one catches everything above ~8s */
+#define STATS_HISTOGRAM_BUCKETS 24
+
+struct stats_histogram
+{
+  volatile gint count;
+  volatile gint max;
+  volatile gint buckets[STATS_HISTOGRAM_BUCKETS];
+};
+typedef struct stats_histogram stats_histogram_t;
+
+void stats_histogram_add(stats_histogram_t *hist, gint64 usecs);
+void stats_histogram_reset(stats_histogram_t *hist);
+void stats_histogram_print(GString *s, const char *name,
+                           stats_histogram_t *hist);
+
+/* method is the registered handler name if known */
+void stats_method_call(const char *method, gboolean known, int result_type,
+                       gint64 usecs);
+void stats_invalid_interface(void);
+/* rejected before reaching the handler, not in the per method figures */
+void stats_bad_signature(void);
+void stats_signal(void);
+void stats_reply_failed(void);
+void stats_rate_limited(gboolean coalesced);
+void stats_dispatch_queued(guint depth);
+void stats_dispatch_wait(gint64 usecs);
+void stats_message_sent(DBusConnection *dbus, gboolean ok);
+void stats_ipm_changed(gboolean show, guint depth);
+void stats_ipm_occluded(guint unmapped, guint occluded);
+void stats_plugin_loaded(gboolean ok, gint64 usecs);
+
+gboolean stats_init(system_ui_data *ui);
+void stats_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_STATS_H
@@ -0,0 +1,161 @@
+#ifndef SYSTEMUI_IPM_SHM_H
+#define SYSTEMUI_IPM_SHM_H
+
+/* Snapshot of the systemui window stack, published in shared memory on
+ * every window shown or hidden. Readers map the segment read-only and copy
+ * it out under a seqlock, no D-Bus round trip and no locking against
+ * systemui is involved:
+ *
+ *   const systemui_ipm_shm_t *shm = systemui_ipm_shm_open();
+ *   systemui_ipm_snapshot_t snap;
+ *
+ *   if (shm && systemui_ipm_shm_read(shm, &snap) && snap.count &&
+ *       !strcmp(snap.stack[0].name, "TouchScreenLock"))
+ *     ...
+ *
+ * The segment is recreated when systemui restarts. A mapping whose pid is 0
+ * or belongs to a dead process is stale and has to be reopened.
+ *
+ * Anyone can create a segment of that name while systemui is not running,
+ * so it is only mapped if it is owned by the uid systemui runs as: the
+ * reader's own one with systemui_ipm_shm_open(), systemui_ipm_shm_open_as()
+ * for readers running as someone else.
+ *
+ * Everything here is inline and depends on libc only, link with -lrt on
+ * systems where shm_open() lives there.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdint.h>
+
+#define SYSTEMUI_IPM_SHM_NAME "/systemui-ipm"
+#define SYSTEMUI_IPM_SHM_MAGIC 0x4d504955 /* "UIPM" */
+#define SYSTEMUI_IPM_SHM_VERSION 1
+
+/* windows beyond this are counted but not listed */
+#define SYSTEMUI_IPM_SHM_MAX_WINDOWS 16
+#define SYSTEMUI_IPM_SHM_NAME_SIZE 32
+
+typedef struct
+{
+  uint32_t priority;
+  /* _HILDON_STACKING_LAYER, -1 if the priority has none */
+  int32_t layer;
+  /* priority class, e.g. "AlarmDialog", empty if it is not a named one */
+  char name[SYSTEMUI_IPM_SHM_NAME_SIZE];
+} systemui_ipm_window_t;
+
+typedef struct
+{
+  /* windows in the stack, may exceed SYSTEMUI_IPM_SHM_MAX_WINDOWS */
+  uint32_t count;
+  /* number of valid stack entries */
+  uint32_t listed;
+  /* CLOCK_MONOTONIC usecs of the last change */
+  uint64_t timestamp;
+  /* topmost first */
+  systemui_ipm_window_t stack[SYSTEMUI_IPM_SHM_MAX_WINDOWS];
+} systemui_ipm_snapshot_t;
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  /* sizeof(systemui_ipm_shm_t) of the writer */
+  uint32_t size;
+  /* systemui pid, 0 once it has shut down */
+  volatile int32_t pid;
+  /* odd while the snapshot is being written */
+  volatile uint32_t seq;
+  uint32_t reserved;
+  systemui_ipm_snapshot_t snapshot;
+} systemui_ipm_shm_t;
+
+/* NULL if systemui does not run as owner, or publishes an incompatible
+ * layout */
+static inline const systemui_ipm_shm_t *
+systemui_ipm_shm_open_as(uid_t owner)
+{
+  const systemui_ipm_shm_t *shm;
+  struct stat st;
+  int fd = shm_open(SYSTEMUI_IPM_SHM_NAME, O_RDONLY, 0);
+
+  if (fd < 0)
+    return NULL;
+
+  /* a short segment would fault on access */
+  if (fstat(fd, &st) || st.st_uid != owner ||
+      st.st_size < (off_t)sizeof(*shm))
+  {
+    close(fd);
+    return NULL;
+  }
+
+  shm = (const systemui_ipm_shm_t *)mmap(NULL, sizeof(*shm), PROT_READ,
+                                         MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (shm == MAP_FAILED)
+    return NULL;
+
+  if (shm->magic != SYSTEMUI_IPM_SHM_MAGIC ||
+      shm->version != SYSTEMUI_IPM_SHM_VERSION || shm->size != sizeof(*shm))
+  {
+    munmap((void *)shm, sizeof(*shm));
+    return NULL;
+  }
+
+  return shm;
+}
+
+/* systemui runs as the session user, as do most readers */
+static inline const systemui_ipm_shm_t *
+systemui_ipm_shm_open(void)
+{
+  return systemui_ipm_shm_open_as(geteuid());
+}
+
+static inline void
+systemui_ipm_shm_close(const systemui_ipm_shm_t *shm)
+{
+  if (shm)
+    munmap((void *)shm, sizeof(*shm));
+}
+
+/* copies a consistent snapshot, 0 if the writer kept changing it or is
+ * gone */
+static inline int
+systemui_ipm_shm_read(const systemui_ipm_shm_t *shm,
+                      systemui_ipm_snapshot_t *snapshot)
+{
+  int tries;
+
+  for (tries = 0; tries < 100; tries++)
+  {
+    uint32_t seq = shm->seq;
+
+    if (seq & 1)
+      continue;
+
+    __sync_synchronize();
+    memcpy(snapshot, (const void *)&shm->snapshot, sizeof(*snapshot));
+    __sync_synchronize();
+
+    if (shm->seq == seq)
+    {
+      if (snapshot->listed > SYSTEMUI_IPM_SHM_MAX_WINDOWS)
+        snapshot->listed = SYSTEMUI_IPM_SHM_MAX_WINDOWS;
+
+      return shm->pid != 0;
+    }
+  }
+
+  return 0;
+}
+
+#endif // SYSTEMUI_IPM_SHM_H
@@ -10,9 +10,19 @@
 #include <libintl.h>
 #include <systemui/dbus-names.h>
 #include <errno.h>
+#include <gdk/gdkx.h>
 
+#include "capture.h"
 #include "dbus.h"
+#include "dispatch.h"
+#include "i18n.h"
+#include "icons.h"
+#include "ipm.h"
 #include "plugin.h"
+#include "ready.h"
+#include "settings.h"
+#include "thermal.h"
+#include "wakeup.h"
 
 #include "config.h"
 
@@ -41,6 +51,37 @@ struct hsl_prio_map prios_map[] =
 system_ui_data *app_ui_data = NULL;
 guint32 uint32arg = 'u';
 
+/* handler name -> interned D-Bus signature */
+static GTree *handler_signatures = NULL;
+
+gint
+hsl_prio_by_name(const char *name)
+{
+  int i;
+
+  for (i = 0; i < sizeof(prios_map) / sizeof(prios_map[0]); i++)
+  {
+    if (!strcmp(prios_map[i].name, name))
+      return prios_map[i].prio;
+  }
+
+  return -1;
+}
+
+const char *
+hsl_name_by_prio(guint prio)
+{
+  int i;
+
+  for (i = 0; i < sizeof(prios_map) / sizeof(prios_map[0]); i++)
+  {
+    if (prios_map[i].prio == prio)
+      return prios_map[i].name;
+  }
+
+  return NULL;
+}
+
 void
 systemui_do_callback(system_ui_data *ui, system_ui_callback_t *callback,
                      dbus_int32_t ret_val)
@@ -118,18 +159,64 @@ free_callback(system_ui_callback_t *callback)
 gboolean
 systemui_remove_handler(const char *name, system_ui_data *ui)
 {
-  gconstpointer handler;
+  gpointer key;
 
   g_return_val_if_fail(ui->handlers != NULL, FALSE);
 
-  if (!(handler = g_tree_lookup(ui->handlers, name)))
+  if (!g_tree_lookup_extended(ui->handlers, name, &key, NULL))
     return FALSE;
 
-  g_tree_remove(ui->handlers, handler);
+  /* keys are strdup()ed, the tree has no destroy function for them */
+  g_tree_remove(ui->handlers, name);
+  free(key);
+  handler_set_signature(name, NULL);
+  plugin_handler_removed(name);
 
   return TRUE;
 }
 
+const char *
+handler_get_name(system_ui_data *ui, const char *name)
+{
+  gpointer key;
+
+  if (!ui->handlers || !g_tree_lookup_extended(ui->handlers, name, &key, NULL))
+    return NULL;
+
+  return key;
+}
+
+const char *
+handler_get_signature(const char *name)
+{
+  if (!handler_signatures)
+    return NULL;
+
+  return g_tree_lookup(handler_signatures, name);
+}
+
+void
+handler_set_signature(const char *name, const char *signature)
+{
+  if (!signature)
+  {
+    if (handler_signatures)
+      g_tree_remove(handler_signatures, name);
+
+    return;
+  }
+
+  if (!handler_signatures)
+  {
+    handler_signatures =
+        g_tree_new_full((GCompareDataFunc)g_ascii_strcasecmp, NULL, g_free,
+                        NULL);
+  }
+
+  g_tree_replace(handler_signatures, g_strdup(name),
+                 (gpointer)g_intern_string(signature));
+}
+
 gboolean
 remove_handler(const char *name, system_ui_data *ui)
 {
@@ -148,6 +235,7 @@ systemui_add_handler(const char *name, system_ui_handler handler,
     if (!g_tree_lookup(ui->handlers, name))
     {
       g_tree_insert(ui->handlers, strdup(name), handler);
+      plugin_handler_added(name);
       return TRUE;
     }
   }
@@ -163,6 +251,26 @@ add_handler(const char *name, system_ui_handler handler, system_ui_data *ui)
   return systemui_add_handler(name, handler, ui);
 }
 
+gboolean
+systemui_add_handler_with_signature(const char *name,
+                                    system_ui_handler handler,
+                                    const char *signature,
+                                    system_ui_data *ui)
+{
+  if (signature && !dbus_signature_validate(signature, NULL))
+  {
+    SYSTEMUI_ERROR("Invalid signature '%s' for handler %s", signature, name);
+    return FALSE;
+  }
+
+  if (!systemui_add_handler(name, handler, ui))
+    return FALSE;
+
+  handler_set_signature(name, signature);
+
+  return TRUE;
+}
+
 gboolean
 systemui_check_plugin_arguments(GArray *args, int *supportedargs, guint argc)
 {
@@ -367,6 +475,17 @@ static void usage(const char *program)
     "System UI\n"
     "\n"
     "  -d, --daemon        run systemui as a daemon\n"
+    "      --headless      do not use X, record window stacking instead,\n"
+    "                      plugins may not create widgets\n"
+    "      --settings=FILE use FILE as settings snapshot\n"
+    "      --ready-fd=FD   write each readiness stage reached to FD\n"
+    "      --plugin-path=DIR\n"
+    "                      load plugins from DIR\n"
+    "      --record=FILE   capture incoming requests and signals to FILE,\n"
+    "                      see systemui-replay\n"
+    "      --ipm-record=FILE\n"
+    "                      write the recorded stacking to FILE on exit,\n"
+    "                      implies --headless\n"
     "      --help          display this help and exit\n"
     "      --version       output version information and exit\n"
     "\n",
@@ -382,6 +501,10 @@ int
 main(int argc, char **argv)
 {
   gboolean daemonflag = FALSE;
+  gboolean headless = FALSE;
+  const char *ipm_record_file = NULL;
+  const char *settings_file = NULL;
+  const char *capture_file = NULL;
   int opt;
   int ind;
   static struct option long_options[] =
@@ -389,6 +512,12 @@ main(int argc, char **argv)
     {"daemon", 0, 0, 'd'},
     {"help", 0, 0, 'h'},
     {"version", 0, 0, 'V'},
+    {"headless", 0, 0, 'H'},
+    {"ipm-record", 1, 0, 'R'},
+    {"plugin-path", 1, 0, 'P'},
+    {"settings", 1, 0, 'C'},
+    {"ready-fd", 1, 0, 'F'},
+    {"record", 1, 0, 'W'},
     {0, 0, 0, 0}
   };
 
@@ -401,9 +530,7 @@ main(int argc, char **argv)
             TEXT_DOMAIN,
             "/usr/share/locale");
 
-  bindtextdomain(TEXT_DOMAIN, "/usr/share/locale");
-  bind_textdomain_codeset(TEXT_DOMAIN, "UTF-8");
-  textdomain(TEXT_DOMAIN);
+  i18n_init(app_ui_data);
 
   while (1)
   {
@@ -412,18 +539,36 @@ main(int argc, char **argv)
     if (opt == -1)
       break;
 
-    daemonflag = TRUE;
-
-    if (opt != 'd')
+    switch (opt)
     {
-      if (opt == 'h' || opt != 'V')
-      {
+      case 'd':
+        daemonflag = TRUE;
+        break;
+      case 'H':
+        headless = TRUE;
+        break;
+      case 'R':
+        headless = TRUE;
+        ipm_record_file = optarg;
+        break;
+      case 'P':
+        plugin_set_path(optarg);
+        break;
+      case 'C':
+        settings_file = optarg;
+        break;
+      case 'F':
+        ready_set_fd(atoi(optarg));
+        break;
+      case 'W':
+        capture_file = optarg;
+        break;
+      case 'V':
+        fprintf(stdout, "%s v%s", PACKAGE_NAME, PACKAGE_VERSION);
+        exit(0);
+      default:
         usage(argv[0]);
         exit(0);
-      }
-
-      fprintf(stdout, "%s v%s", PACKAGE_NAME, PACKAGE_VERSION);
-      exit(0);
     }
   }
 
@@ -450,24 +595,53 @@ main(int argc, char **argv)
 
   build_layers_tab();
 
-  gtk_init(&argc, &argv);
+  if (headless)
+  {
+    /* no display is needed, GTK just cannot be used for widgets without
+     * one. Plugins are told so in systemui.h */
+    if (!gtk_init_check(&argc, &argv))
+      ULOG_INFO("No display, plugins must not create widgets");
+
+    ipm_set_backend(&ipm_backend_record);
+  }
+  else
+    gtk_init(&argc, &argv);
+
 #if !GLIB_CHECK_VERSION(2, 32, 0)
   g_thread_init(NULL);
 #endif
-  app_ui_data->icontheme = gtk_icon_theme_get_default();
+
+  if (!headless)
+  {
+    Display *dpy = gdk_x11_display_get_xdisplay(gdk_display_get_default());
+
+    wakeup_watch_fd(ConnectionNumber(dpy), "x11");
+  }
+
   app_ui_data->gc_client = gconf_client_get_default();
 
   g_return_val_if_fail(app_ui_data->gc_client, 1);
 
-  gconf_client_add_dir(app_ui_data->gc_client, SYSTEMUI_GCONF_DIR,
-                       GCONF_CLIENT_PRELOAD_NONE, NULL);
+  settings_init(app_ui_data, settings_file);
+  icons_init(app_ui_data);
+
+  if (capture_file)
+    g_return_val_if_fail(capture_init(capture_file), 1);
 
   g_return_val_if_fail(dbus_init(app_ui_data), 1);
+
+  /* replaces the segment, a second instance must not get this far */
+  ipm_shm_init(app_ui_data);
+
+  if (headless)
+    ipm_record_init(app_ui_data, ipm_record_file);
+
   g_return_val_if_fail(init_thermal_message_rcvr(app_ui_data), 1);
+  ready_reached(app_ui_data, READY_STAGE_CORE);
 
   if (init_plugins(app_ui_data))
   {
-    gconf_client_clear_cache(app_ui_data->gc_client);
+    ready_reached(app_ui_data, READY_STAGE_PLUGINS);
 
     if (app_ui_data->system_bus)
     {
@@ -484,15 +658,29 @@ main(int argc, char **argv)
     close_plugins();
   }
 
+  if (headless)
+    ipm_record_finish(app_ui_data);
+
+  thermal_finish(app_ui_data);
+  capture_finish();
   dbus_finish(app_ui_data);
-  gconf_client_remove_dir(app_ui_data->gc_client, SYSTEMUI_GCONF_DIR, NULL);
+  ipm_shm_finish(app_ui_data);
+  icons_finish(app_ui_data);
+  settings_finish(app_ui_data);
   g_object_unref(app_ui_data->gc_client);
 
   app_ui_data->gc_client = NULL;
   app_ui_data->system_bus = NULL;
   g_hash_table_unref(app_ui_data->hsl_tab);
 
+  if (handler_signatures)
+  {
+    g_tree_destroy(handler_signatures);
+    handler_signatures = NULL;
+  }
+
   app_ui_data->hsl_tab = NULL;
+  i18n_finish(app_ui_data);
   g_free(app_ui_data);
   closelog();
 
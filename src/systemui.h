@@ -43,7 +43,7 @@ typedef struct
   DBusError dbuserror;
   GMainLoop *mainloop;
   DBusConnection *system_bus;
-  GtkIconTheme *icontheme;
+  GtkIconTheme *icontheme; /* use systemui_get_icon_theme() */
   GtkWidget *parent; /* is that supposed to be desktop widget ?!? */
   GHashTable *hsl_tab;
   int unk2;
@@ -76,6 +76,10 @@ typedef union
 } DBusBasicValue;
 #endif
 
+/* for container types (array, struct, variant, dict entry) data holds an
+ * opaque pointer, use systemui_arg_recurse() or systemui_arg_get_fixed_array()
+ * on it. Those point into the request and are valid during the handler call
+ * only */
 typedef struct
 {
   int arg_type;
@@ -108,6 +112,28 @@ typedef int (*system_ui_handler)(const char *interface,
                                  system_ui_data *ui,
                                  system_ui_handler_arg *result);
 
+/* handler return value telling the reply was built with systemui_reply_iter()
+ * or systemui_reply_append() rather than returned in result */
+#define SYSTEMUI_REPLY_APPENDED 'R'
+
+/* the reply to the call result belongs to, to append any number of values
+ * and containers to. Valid during the handler call only, the handler must
+ * then return SYSTEMUI_REPLY_APPENDED */
+extern DBusMessageIter *
+systemui_reply_iter(system_ui_handler_arg *result);
+/* same arguments as dbus_message_append_args() */
+extern gboolean
+systemui_reply_append(system_ui_handler_arg *result, int first_arg_type, ...);
+
+/* zero-copy access to an array of fixed size elements (numbers, booleans) */
+extern gboolean
+systemui_arg_get_fixed_array(const system_ui_handler_arg *arg,
+                             int element_type, const void **elements,
+                             int *n_elements);
+/* sub is set to iterate over the contents of a container argument */
+extern gboolean
+systemui_arg_recurse(const system_ui_handler_arg *arg, DBusMessageIter *sub);
+
 extern gboolean
 systemui_check_plugin_arguments(GArray *args, int *supportedargs, guint argc);
 extern gboolean
@@ -128,6 +154,9 @@ do_callback(system_ui_data *ui, system_ui_callback_t *callback,
 extern void
 systemui_free_callback(system_ui_callback_t *callback);
 
+/* with --headless windows are only recorded, never mapped. There may be no
+ * display at all then, so plugins meant to run headless must not create
+ * widgets, any GObject will do as a window */
 extern gboolean
 ipm_hide_window(GtkWidget *widget);
 extern gboolean
@@ -139,14 +168,121 @@ systemui_add_handler(const char *name, system_ui_handler handler,
 extern gboolean
 add_handler(const char *name, system_ui_handler handler, system_ui_data *ui);
 
+/* requests whose D-Bus signature (e.g. "ssssu") doesn't match are rejected
+ * with InvalidArgs before any argument is unpacked */
+extern gboolean
+systemui_add_handler_with_signature(const char *name,
+                                    system_ui_handler handler,
+                                    const char *signature,
+                                    system_ui_data *ui);
+
 
 extern gboolean
 systemui_remove_handler(const char *name, system_ui_data *ui);
 extern gboolean
 remove_handler(const char *name, system_ui_data *ui);
 
+/* priority is one of the window priorities (e.g. 290 for TouchScreenLock),
+ * requests for higher priority methods and signals are dispatched first */
+extern gboolean
+systemui_set_handler_priority(const char *name, unsigned int priority,
+                              system_ui_data *ui);
+
+/* translation of msgid, cached. Valid until the next locale change */
+extern const char *
+systemui_dgettext(const char *domain, const char *msgid);
+/* like bindtextdomain(), the domain is rebound when the locale changes */
+extern void
+systemui_bind_textdomain(const char *domain, const char *dir);
+
+typedef void (*systemui_locale_changed_func)(system_ui_data *ui,
+                                             const char *locale,
+                                             gpointer user_data);
+
+/* called after LC_MESSAGES was switched, to retranslate visible widgets.
+ * LANG is not updated, pass the locale on to children explicitly */
+extern guint
+systemui_locale_notify_add(systemui_locale_changed_func func,
+                           gpointer user_data);
+extern void
+systemui_locale_notify_remove(guint id);
+
+/* thermal manager states, in increasing severity */
+typedef enum
+{
+  SYSTEMUI_THERMAL_UNKNOWN = 0,
+  SYSTEMUI_THERMAL_NORMAL,
+  SYSTEMUI_THERMAL_WARNING,
+  SYSTEMUI_THERMAL_ALERT,
+  SYSTEMUI_THERMAL_FATAL
+} systemui_thermal_state_t;
+
+typedef void (*systemui_thermal_action_func)(system_ui_data *ui,
+                                             systemui_thermal_state_t state,
+                                             systemui_thermal_state_t previous,
+                                             gpointer user_data);
+
+/* the debounced state, SYSTEMUI_THERMAL_UNKNOWN until the first signal */
+extern systemui_thermal_state_t
+systemui_thermal_get_state(void);
+/* func is called each time the state enters level, for every change with
+ * SYSTEMUI_THERMAL_UNKNOWN */
+extern guint
+systemui_thermal_action_add(systemui_thermal_state_t level,
+                            systemui_thermal_action_func func,
+                            gpointer user_data);
+extern void
+systemui_thermal_action_remove(guint id);
+
+/* like g_timeout_add_seconds(), but all of them share one main loop source,
+ * timers due in the same second run on a single wakeup */
+extern guint
+systemui_timeout_add_seconds(guint interval, GSourceFunc func, gpointer data);
+extern void
+systemui_timeout_remove(guint id);
+
+/* a{sv} of the values queued with systemui_signal_property() */
+#define SYSTEMUI_PROPERTIES_SIG "properties_changed"
+
+/* broadcasts member from ui->signalpath on ui->signalinterface, arguments as
+ * for dbus_message_append_args(). It is sent once the main loop gets idle,
+ * until then a later one with the same member and key replaces it, so
+ * listeners only wake up for the latest value. key may be NULL */
+extern gboolean
+systemui_signal_emit(system_ui_data *ui, const char *member, const char *key,
+                     int first_arg_type, ...);
+/* name and a basic type value for a single SYSTEMUI_PROPERTIES_SIG sent
+ * along with the other pending signals, a later value replaces it */
+extern gboolean
+systemui_signal_property(system_ui_data *ui, const char *name, int type,
+                         const void *value);
+
+/* the icon theme is only loaded on first use, always NULL with --headless.
+ * ui->icontheme stays NULL until then, plugins must not read it directly */
+extern GtkIconTheme *
+systemui_get_icon_theme(system_ui_data *ui);
+/* icon name from the theme, or an image file if name is an absolute path,
+ * at size pixels. Decoded images are shared by all plugins and evicted least
+ * recently used first, returns a new reference or NULL */
+extern GdkPixbuf *
+systemui_icon_cache_load(system_ui_data *ui, const char *name, gint size);
+/* decodes names, NULL terminated, at idle priority so that the first dialog
+ * showing them does not have to */
+extern void
+systemui_icon_cache_prewarm(system_ui_data *ui, const char *const *names,
+                            gint size);
+
+/* whether widget, once shown with WindowPriority_ShowWindow(), hides all
+ * windows of lower priority, which are then unmapped until it is hidden.
+ * Windows covering the whole screen without an RGBA colormap are opaque
+ * unless set otherwise */
+extern void
+systemui_ipm_set_opaque(GtkWidget *widget, gboolean opaque);
+
 void plugin_close(system_ui_data *ui);
 gboolean plugin_init(system_ui_data *ui);
+/* optional, called for loaded plugins after the locale changed */
+void plugin_locale_changed(system_ui_data *ui, const char *locale);
 
 #ifdef DEBUG
 
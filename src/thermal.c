@@ -0,0 +1,364 @@
+#include <canberra.h>
+#include <mce/dbus-names.h>
+#include <systemui/dbus-names.h>
+#include <osso-log.h>
+#include <string.h>
+#include <systemui.h>
+
+#include "config.h"
+
+#ifdef WITH_HILDON
+#include <hildon/hildon-banner.h>
+#endif
+
+#include "dbus.h"
+#include "ipm.h"
+#include "settings.h"
+#include "thermal.h"
+#include "watch-list.h"
+
+#define THERMAL_DEFAULT_DEBOUNCE_MS 500
+#define THERMAL_DEFAULT_HYSTERESIS_MS 10000
+
+struct thermal_change
+{
+  system_ui_data *ui;
+  systemui_thermal_state_t previous;
+};
+typedef struct thermal_change thermal_change_t;
+
+static const char *state_names[] =
+{
+  "unknown",
+  "normal",
+  "warning",
+  "alert",
+  "fatal"
+};
+
+static const gchar *vibrator_pattern = "PatternIncomingMessage";
+
+static systemui_thermal_state_t state = SYSTEMUI_THERMAL_UNKNOWN;
+static systemui_thermal_state_t pending = SYSTEMUI_THERMAL_UNKNOWN;
+static guint pending_id = 0;
+
+static guint debounce_ms = THERMAL_DEFAULT_DEBOUNCE_MS;
+static guint hysteresis_ms = THERMAL_DEFAULT_HYSTERESIS_MS;
+static guint config_notify_id = 0;
+
+/* data is the level */
+static watch_list_t actions = WATCH_LIST_INIT(NULL);
+static guint shutdown_action_id = 0;
+
+static system_ui_data *thermal_ui = NULL;
+
+static systemui_thermal_state_t
+thermal_state_from_string(const char *s)
+{
+  int i;
+
+  for (i = SYSTEMUI_THERMAL_NORMAL; i < G_N_ELEMENTS(state_names); i++)
+  {
+    if (!strcmp(s, state_names[i]))
+      return i;
+  }
+
+  return SYSTEMUI_THERMAL_UNKNOWN;
+}
+
+static void
+thermal_send_signal(system_ui_data *ui)
+{
+  dbus_uint32_t u = state;
+  const char *name = state_names[state];
+
+  systemui_signal_emit(ui, SYSTEMUI_THERMAL_SIG, NULL,
+                       DBUS_TYPE_UINT32, &u,
+                       DBUS_TYPE_STRING, &name,
+                       DBUS_TYPE_INVALID);
+}
+
+static void
+thermal_action_call(watch_t *w, gpointer call_data)
+{
+  thermal_change_t *change = call_data;
+  systemui_thermal_state_t level = GPOINTER_TO_UINT(w->data);
+
+  if (level == SYSTEMUI_THERMAL_UNKNOWN || level == state)
+  {
+    ((systemui_thermal_action_func)w->func)(change->ui, state,
+                                            change->previous, w->user_data);
+  }
+}
+
+static void
+thermal_enter(system_ui_data *ui, systemui_thermal_state_t new_state)
+{
+  thermal_change_t change = {ui, state};
+
+  if (pending_id)
+  {
+    g_source_remove(pending_id);
+    pending_id = 0;
+  }
+
+  pending = SYSTEMUI_THERMAL_UNKNOWN;
+
+  if (new_state == state)
+    return;
+
+  state = new_state;
+  ULOG_INFO("Thermal state '%s' -> '%s'", state_names[change.previous],
+            state_names[state]);
+
+  thermal_send_signal(ui);
+
+  watch_list_call(&actions, thermal_action_call, &change);
+}
+
+static gboolean
+thermal_pending_timeout(gpointer user_data)
+{
+  pending_id = 0;
+  thermal_enter(user_data, pending);
+
+  return FALSE;
+}
+
+void
+thermal_handle_signal(system_ui_data *ui, DBusMessage *msg)
+{
+  DBusMessageIter iter;
+  const char *s;
+  systemui_thermal_state_t new_state;
+
+  if (!dbus_message_iter_init(msg, &iter) ||
+      dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_STRING)
+  {
+    return;
+  }
+
+  dbus_message_iter_get_basic(&iter, &s);
+
+  if ((new_state = thermal_state_from_string(s)) == SYSTEMUI_THERMAL_UNKNOWN)
+  {
+    SYSTEMUI_WARNING("Unknown thermal state '%s'", s);
+    return;
+  }
+
+  /* burst of the same report */
+  if (new_state == pending)
+    return;
+
+  if (new_state == SYSTEMUI_THERMAL_FATAL ||
+      state == SYSTEMUI_THERMAL_UNKNOWN)
+  {
+    thermal_enter(ui, new_state);
+    return;
+  }
+
+  /* flapped back */
+  if (new_state == state)
+  {
+    if (pending_id)
+    {
+      g_source_remove(pending_id);
+      pending_id = 0;
+    }
+
+    pending = SYSTEMUI_THERMAL_UNKNOWN;
+    return;
+  }
+
+  if (pending_id)
+    g_source_remove(pending_id);
+
+  pending = new_state;
+  pending_id = g_timeout_add(new_state > state ? debounce_ms : hysteresis_ms,
+                             thermal_pending_timeout, ui);
+}
+
+systemui_thermal_state_t
+systemui_thermal_get_state(void)
+{
+  return state;
+}
+
+guint
+systemui_thermal_action_add(systemui_thermal_state_t level,
+                            systemui_thermal_action_func func,
+                            gpointer user_data)
+{
+  g_return_val_if_fail(func != NULL, 0);
+  g_return_val_if_fail(level <= SYSTEMUI_THERMAL_FATAL, 0);
+
+  return watch_list_add(&actions, G_CALLBACK(func), GUINT_TO_POINTER(level),
+                        user_data);
+}
+
+void
+systemui_thermal_action_remove(guint id)
+{
+  watch_list_remove(&actions, id);
+}
+
+static gboolean
+vibrator_deactivate(system_ui_data *ui)
+{
+  DBusMessage *msg;
+
+  msg = dbus_message_new_method_call(MCE_SERVICE,
+                                     MCE_REQUEST_PATH,
+                                     MCE_REQUEST_IF,
+                                     MCE_DEACTIVATE_VIBRATOR_PATTERN);
+  dbus_message_append_args(msg,
+                           DBUS_TYPE_STRING, &vibrator_pattern,
+                           DBUS_TYPE_INVALID);
+  dbus_send_message(ui->system_bus, msg);
+
+  return FALSE;
+}
+
+/* runs again if the device cooled down and got hot again */
+static void
+thermal_shutdown_note(system_ui_data *ui, systemui_thermal_state_t new_state,
+                      systemui_thermal_state_t previous, gpointer user_data)
+{
+  DBusMessage *msg;
+  ca_context *c = 0;
+  int ca_error;
+#ifdef WITH_HILDON
+  GtkWidget *banner;
+#endif
+
+  dbus_send_message(ui->system_bus,
+                    dbus_message_new_method_call(MCE_SERVICE,
+                                                 MCE_REQUEST_PATH,
+                                                 MCE_REQUEST_IF,
+                                                 MCE_DISPLAY_ON_REQ));
+
+  msg = dbus_message_new_method_call(MCE_SERVICE,
+                                     MCE_REQUEST_PATH,
+                                     MCE_REQUEST_IF,
+                                     MCE_ACTIVATE_VIBRATOR_PATTERN);
+  dbus_message_append_args(msg,
+                           DBUS_TYPE_STRING, &vibrator_pattern,
+                           DBUS_TYPE_INVALID);
+  dbus_send_message(ui->system_bus, msg);
+
+  systemui_timeout_add_seconds(2, (GSourceFunc)vibrator_deactivate, ui);
+
+  ca_error = ca_context_create(&c);
+  if (!ca_error)
+  {
+    ca_error = ca_context_play(c, 0,
+                               CA_PROP_MEDIA_FILENAME,
+                               "/usr/share/sounds/ui-information_note.wav",
+                               CA_PROP_MEDIA_NAME,
+                               "Thermal Shutdown Notification",
+                               NULL);
+  }
+
+  if (ca_error)
+    SYSTEMUI_ERROR("Failed to play sound (%d, %s)", ca_error,
+                   ca_strerror(ca_error));
+#ifdef WITH_HILDON
+  if (!ipm_headless())
+  {
+    banner = hildon_banner_show_information(
+          NULL, NULL,
+          systemui_dgettext("osso-powerup-shutdown",
+                            "dpup_ia_thermal_shutdown"));
+    hildon_banner_set_timeout(HILDON_BANNER(banner), 9000);
+    gtk_widget_show_all(banner);
+    WindowPriority_ShowWindow(banner, 300u);
+  }
+#endif
+}
+
+static int
+thermal_handler(const char *interface, const char *method, GArray *args,
+                system_ui_data *ui, system_ui_handler_arg *result)
+{
+  dbus_uint32_t u = state;
+  const char *name = state_names[state];
+
+  if (!systemui_reply_append(result,
+                             DBUS_TYPE_UINT32, &u,
+                             DBUS_TYPE_STRING, &name,
+                             DBUS_TYPE_INVALID))
+  {
+    return 0;
+  }
+
+  return SYSTEMUI_REPLY_APPENDED;
+}
+
+static void
+thermal_load_config(system_ui_data *ui)
+{
+  debounce_ms = MAX(settings_get_int(ui, SYSTEMUI_GCONF_THERMAL_DEBOUNCE,
+                                     THERMAL_DEFAULT_DEBOUNCE_MS), 0);
+  hysteresis_ms = MAX(settings_get_int(ui, SYSTEMUI_GCONF_THERMAL_HYSTERESIS,
+                                       THERMAL_DEFAULT_HYSTERESIS_MS), 0);
+}
+
+static void
+thermal_config_changed(system_ui_data *ui, const char *key, gpointer user_data)
+{
+  thermal_load_config(ui);
+}
+
+gboolean
+init_thermal_message_rcvr(system_ui_data *ui)
+{
+  dbus_bus_add_match(ui->system_bus,
+                     "type='signal',interface='" THERMAL_MANAGER_IF "',"
+                     "member='" THERMAL_STATE_CHANGE_SIG "'",
+                     &ui->dbuserror);
+
+  if (dbus_error_is_set(&ui->dbuserror))
+  {
+    ULOG_WARN("Failed to add match for thermal notifications");
+    dbus_error_free(&ui->dbuserror);
+    return FALSE;
+  }
+
+  thermal_ui = ui;
+  thermal_load_config(ui);
+  config_notify_id = settings_notify_add(SYSTEMUI_GCONF_THERMAL_DIR,
+                                         thermal_config_changed, NULL);
+  shutdown_action_id = systemui_thermal_action_add(SYSTEMUI_THERMAL_FATAL,
+                                                   thermal_shutdown_note,
+                                                   NULL);
+
+  if (!systemui_add_handler_with_signature(SYSTEMUI_THERMAL_REQ,
+                                           thermal_handler, "", ui))
+  {
+    SYSTEMUI_WARNING("Failed to register thermal state handler");
+  }
+
+  return TRUE;
+}
+
+void
+thermal_finish(system_ui_data *ui)
+{
+  if (!thermal_ui)
+    return;
+
+  systemui_remove_handler(SYSTEMUI_THERMAL_REQ, ui);
+  systemui_thermal_action_remove(shutdown_action_id);
+  shutdown_action_id = 0;
+  settings_notify_remove(config_notify_id);
+  config_notify_id = 0;
+
+  if (pending_id)
+  {
+    g_source_remove(pending_id);
+    pending_id = 0;
+  }
+
+  watch_list_clear(&actions);
+  thermal_ui = NULL;
+}
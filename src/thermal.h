@@ -0,0 +1,30 @@
+#ifndef SYSTEMUI_THERMAL_H
+#define SYSTEMUI_THERMAL_H
+
+#define THERMAL_MANAGER_IF "com.nokia.thermalmanager"
+#define THERMAL_STATE_CHANGE_SIG "thermal_state_change_ind"
+
+#define SYSTEMUI_THERMAL_REQ "get_thermal_state"
+/* u state, s state name */
+#define SYSTEMUI_THERMAL_SIG "thermal_state_changed"
+
+#define SYSTEMUI_GCONF_THERMAL_DIR SYSTEMUI_GCONF_DIR "thermal/"
+/* how long a higher state must be reported before it is entered */
+#define SYSTEMUI_GCONF_THERMAL_DEBOUNCE SYSTEMUI_GCONF_THERMAL_DIR "debounce_ms"
+/* how long a lower state must be reported before it is entered */
+#define SYSTEMUI_GCONF_THERMAL_HYSTERESIS \
+  SYSTEMUI_GCONF_THERMAL_DIR "hysteresis_ms"
+
+/*
+ * Raw states from the thermal manager are only candidates. A candidate
+ * replaces the current state once it was reported for the debounce (going
+ * up) or hysteresis (going down) time without anything else in between,
+ * "fatal" is entered immediately. Repeated reports of the candidate or the
+ * current state do not restart the timer.
+ */
+void thermal_handle_signal(system_ui_data *ui, DBusMessage *msg);
+
+gboolean init_thermal_message_rcvr(system_ui_data *app_ui_data);
+void thermal_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_THERMAL_H
@@ -0,0 +1,214 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <systemui.h>
+
+#include "dbus.h"
+#include "trace.h"
+
+volatile gint trace_level = TRACE_LEVEL_INFO;
+
+static trace_record_t ring[TRACE_RING_SIZE];
+static volatile gint ring_head = 0;
+
+/* private to our uid, empty if there is none and dumps are disabled */
+static char dump_dir[256];
+static volatile gint dump_count = 0;
+
+void
+trace_record(guint level, guint event, const char *tag,
+             guint32 a0, guint32 a1, guint32 a2)
+{
+  guint32 seq = (guint32)g_atomic_int_add(&ring_head, 1) + 1;
+  trace_record_t *r = &ring[(seq - 1) & (TRACE_RING_SIZE - 1)];
+
+  /* seq is the commit marker, clear it while the slot is being rewritten */
+  r->seq = 0;
+  r->timestamp = g_get_monotonic_time();
+  r->event = event;
+  r->level = level;
+  r->args[0] = a0;
+  r->args[1] = a1;
+  r->args[2] = a2;
+
+  if (tag)
+    strncpy(r->tag, tag, sizeof(r->tag));
+  else
+    r->tag[0] = 0;
+
+  g_atomic_int_set((volatile gint *)&r->seq, seq);
+}
+
+static gboolean
+write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+
+  while (len)
+  {
+    ssize_t n = write(fd, p, len);
+
+    if (n < 0)
+      return FALSE;
+
+    p += n;
+    len -= n;
+  }
+
+  return TRUE;
+}
+
+/* appends "trace-<n>.bin" to dump_dir, no stdio in a signal handler */
+static gboolean
+dump_file_name(char *path, gsize size, guint n)
+{
+  char digits[10];
+  gsize len = strlen(dump_dir);
+  gsize i = 0;
+
+  do
+  {
+    digits[i++] = '0' + n % 10;
+    n /= 10;
+  }
+  while (n);
+
+  if (len + strlen("/trace-.bin") + i >= size)
+    return FALSE;
+
+  memcpy(path, dump_dir, len);
+  memcpy(path + len, "/trace-", 7);
+  len += 7;
+
+  while (i)
+    path[len++] = digits[--i];
+
+  memcpy(path + len, ".bin", 5);
+
+  return TRUE;
+}
+
+/* only async-signal-safe calls in here, it runs from the SIGUSR1 handler.
+ * Dumps rotate over TRACE_DUMP_KEEP files in the private dump directory, the
+ * name of the one written is stored in path */
+gboolean
+trace_dump(char *path, gsize size)
+{
+  trace_file_header_t hdr;
+  gboolean rv;
+  int fd;
+
+  if (!dump_dir[0])
+    return FALSE;
+
+  if (!dump_file_name(path, size,
+                      (guint)g_atomic_int_add(&dump_count, 1) %
+                        TRACE_DUMP_KEEP))
+  {
+    return FALSE;
+  }
+
+  /* nobody else can create anything in there, O_NOFOLLOW is just in case */
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+
+  if (fd < 0)
+    return FALSE;
+
+  memcpy(hdr.magic, TRACE_FILE_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_FILE_VERSION;
+  hdr.record_size = sizeof(trace_record_t);
+  hdr.count = TRACE_RING_SIZE;
+  hdr.head = g_atomic_int_get(&ring_head);
+
+  rv = write_all(fd, &hdr, sizeof(hdr)) && write_all(fd, ring, sizeof(ring));
+  close(fd);
+
+  return rv;
+}
+
+static void
+trace_sigusr1_handler(int sig)
+{
+  char path[sizeof(dump_dir) + 32];
+  int saved_errno = errno;
+
+  trace_dump(path, sizeof(path));
+  errno = saved_errno;
+}
+
+static int
+trace_level_handler(const char *interface, const char *method, GArray *args,
+                    system_ui_data *ui, system_ui_handler_arg *result)
+{
+  system_ui_handler_arg *arg = (system_ui_handler_arg *)args->data;
+
+  if (args->len != 1 || arg->arg_type != DBUS_TYPE_INT32 ||
+      arg->data.i32 < TRACE_LEVEL_OFF || arg->data.i32 > TRACE_LEVEL_VERBOSE)
+  {
+    return 0;
+  }
+
+  g_atomic_int_set(&trace_level, arg->data.i32);
+  SYSTEMUI_NOTICE("Trace level set to %d", arg->data.i32);
+
+  return DBUS_TYPE_VARIANT;
+}
+
+static int
+trace_dump_handler(const char *interface, const char *method, GArray *args,
+                   system_ui_data *ui, system_ui_handler_arg *result)
+{
+  char path[sizeof(dump_dir) + 32];
+
+  if (!trace_dump(path, sizeof(path)))
+  {
+    SYSTEMUI_WARNING("Failed to dump trace to %s",
+                     dump_dir[0] ? dump_dir : TRACE_DUMP_DIR);
+    return 0;
+  }
+
+  return dbus_reply_string(result, g_strdup(path));
+}
+
+/* a directory anyone else can write to would let them plant a symlink or
+ * read the dumps */
+static void
+trace_init_dump_dir(void)
+{
+  gchar *dir = g_build_filename(g_get_user_cache_dir(), TRACE_DUMP_DIR, NULL);
+  struct stat st;
+
+  if (g_mkdir_with_parents(dir, 0700))
+    SYSTEMUI_WARNING("Cannot create %s: %s", dir, strerror(errno));
+  else if (lstat(dir, &st) || !S_ISDIR(st.st_mode) ||
+           st.st_uid != getuid() || (st.st_mode & 077))
+  {
+    SYSTEMUI_WARNING("%s is not a private directory, trace dumps disabled",
+                     dir);
+  }
+  else
+    g_strlcpy(dump_dir, dir, sizeof(dump_dir));
+
+  g_free(dir);
+}
+
+gboolean
+trace_init(system_ui_data *ui)
+{
+  trace_init_dump_dir();
+  signal(SIGUSR1, trace_sigusr1_handler);
+
+  return systemui_add_handler(SYSTEMUI_TRACE_LEVEL_REQ, trace_level_handler,
+                              ui) &&
+      systemui_add_handler(SYSTEMUI_TRACE_DUMP_REQ, trace_dump_handler, ui);
+}
+
+void
+trace_finish(system_ui_data *ui)
+{
+  signal(SIGUSR1, SIG_DFL);
+  systemui_remove_handler(SYSTEMUI_TRACE_DUMP_REQ, ui);
+  systemui_remove_handler(SYSTEMUI_TRACE_LEVEL_REQ, ui);
+}
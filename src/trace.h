@@ -0,0 +1,87 @@
+#ifndef SYSTEMUI_TRACE_H
+#define SYSTEMUI_TRACE_H
+
+#define SYSTEMUI_TRACE_LEVEL_REQ "trace_set_level"
+#define SYSTEMUI_TRACE_DUMP_REQ "trace_dump"
+
+/* below the user cache directory, dumps are named trace-<n>.bin and the
+ * oldest one is overwritten once there are TRACE_DUMP_KEEP */
+#define TRACE_DUMP_DIR "systemui"
+#define TRACE_DUMP_KEEP 4
+
+/* must be power of 2 */
+#define TRACE_RING_SIZE 1024
+
+/*
+ * Dump file layout, native endianness:
+ *   trace_file_header_t
+ *   TRACE_RING_SIZE * trace_record_t, in ring order
+ * A slot is valid if its seq != 0, records are ordered by seq.
+ */
+#define TRACE_FILE_MAGIC "SUITRACE"
+#define TRACE_FILE_VERSION 1
+
+enum trace_level
+{
+  TRACE_LEVEL_OFF = 0,
+  TRACE_LEVEL_INFO,
+  TRACE_LEVEL_VERBOSE
+};
+
+enum trace_event
+{
+  TRACE_EV_NONE = 0,
+  TRACE_EV_METHOD_CALL,    /* tag method, a0 serial */
+  TRACE_EV_METHOD_DONE,    /* tag method, a0 result type, a1 usecs */
+  TRACE_EV_UNKNOWN_METHOD, /* tag method */
+  TRACE_EV_INVALID_IFACE,  /* tag method */
+  TRACE_EV_SIGNAL,         /* tag member */
+  TRACE_EV_SEND,           /* a0 ok, a1 outgoing bytes */
+  TRACE_EV_IPM_SHOW,       /* a0 priority, a1 depth */
+  TRACE_EV_IPM_HIDE,       /* a1 depth */
+  TRACE_EV_PLUGIN_LOAD,    /* tag file name, a0 ok, a1 usecs */
+  TRACE_EV_PLUGIN_UNLOAD,  /* tag file name */
+  TRACE_EV_RATE_LIMITED,   /* tag method, a0 serial */
+  TRACE_EV_COALESCED,      /* tag method, a0 serial */
+  TRACE_EV_BAD_SIGNATURE   /* tag method, a0 serial */
+};
+
+typedef struct
+{
+  char magic[8];
+  guint32 version;
+  guint32 record_size;
+  guint32 count;
+  guint32 head;
+} trace_file_header_t;
+
+typedef struct
+{
+  guint64 timestamp; /* monotonic, usecs */
+  guint32 seq;
+  guint16 event;
+  guint16 level;
+  guint32 args[3];
+  char tag[20];      /* not necessarily NUL terminated */
+} trace_record_t;
+
+extern volatile gint trace_level;
+
+void trace_record(guint level, guint event, const char *tag,
+                  guint32 a0, guint32 a1, guint32 a2);
+
+#define SYSTEMUI_TRACE(level, event, tag, a0, a1, a2) \
+  G_STMT_START \
+  { \
+    if (G_UNLIKELY(g_atomic_int_get(&trace_level) >= (level))) \
+      trace_record((level), (event), (tag), (a0), (a1), (a2)); \
+  } \
+  G_STMT_END
+
+/* path receives the name of the dump file */
+gboolean trace_dump(char *path, gsize size);
+
+gboolean trace_init(system_ui_data *ui);
+void trace_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_TRACE_H
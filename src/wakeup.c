@@ -0,0 +1,425 @@
+#include <time.h>
+#include <systemui.h>
+
+#include "dbus.h"
+#include "plugin.h"
+#include "wakeup.h"
+
+#define WAKEUP_MAX_SOURCES 8
+
+/* the first two are always there */
+#define WAKEUP_SOURCE_TIMEOUT 0
+#define WAKEUP_SOURCE_OTHER 1
+
+struct wakeup_source
+{
+  const char *name;
+  int fd;
+  guint wakeups;
+  gint64 cpu_usecs;
+};
+typedef struct wakeup_source wakeup_source_t;
+
+struct wakeup_handler
+{
+  guint calls;
+  gint64 cpu_usecs;
+};
+typedef struct wakeup_handler wakeup_handler_t;
+
+struct wakeup_timer
+{
+  guint id;
+  gint64 due;
+  guint interval;
+  GSourceFunc func;
+  gpointer data;
+  gboolean removed;
+};
+typedef struct wakeup_timer wakeup_timer_t;
+
+static wakeup_source_t sources[WAKEUP_MAX_SOURCES] =
+{
+  {"timeout", -1, 0, 0},
+  {"other", -1, 0, 0}
+};
+static guint n_sources = 2;
+
+static GPollFunc poll_func = NULL;
+static guint current_source = WAKEUP_SOURCE_OTHER;
+static gint64 awake_cpu = 0;
+static gint64 sleep_usecs = 0;
+static gint64 since = 0;
+
+/* method name -> wakeup_handler_t */
+static GHashTable *handlers = NULL;
+
+/* sorted by due second */
+static GList *timers = NULL;
+/* due timers while their callbacks run */
+static GList *firing = NULL;
+static guint last_timer_id = 0;
+static guint tick_id = 0;
+static gint64 tick_due = 0;
+static guint tick_fires = 0;
+static guint timer_runs = 0;
+
+gint64
+wakeup_thread_cpu_time(void)
+{
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+    return 0;
+
+  return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+void
+wakeup_watch_fd(int fd, const char *name)
+{
+  guint i;
+
+  if (fd < 0)
+    return;
+
+  for (i = WAKEUP_SOURCE_OTHER + 1; i < n_sources; i++)
+  {
+    if (sources[i].fd == fd)
+    {
+      sources[i].name = name;
+      return;
+    }
+  }
+
+  if (n_sources == WAKEUP_MAX_SOURCES)
+  {
+    SYSTEMUI_WARNING("Too many wakeup sources, '%s' counts as other", name);
+    return;
+  }
+
+  sources[n_sources].name = name;
+  sources[n_sources].fd = fd;
+  n_sources++;
+}
+
+static guint
+wakeup_source_for(GPollFD *fds, guint nfds)
+{
+  guint i;
+  guint j;
+
+  for (i = 0; i < nfds; i++)
+  {
+    if (!fds[i].revents)
+      continue;
+
+    for (j = WAKEUP_SOURCE_OTHER + 1; j < n_sources; j++)
+    {
+      if (sources[j].fd == fds[i].fd)
+        return j;
+    }
+  }
+
+  return WAKEUP_SOURCE_OTHER;
+}
+
+static gint
+wakeup_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+  gint64 cpu = wakeup_thread_cpu_time();
+  gint64 start;
+  gint rv;
+
+  /* whatever ran since the last poll was for the last wakeup */
+  sources[current_source].cpu_usecs += cpu - awake_cpu;
+
+  start = g_get_monotonic_time();
+  rv = poll_func(fds, nfds, timeout);
+  awake_cpu = wakeup_thread_cpu_time();
+
+  /* just checking, the loop did not sleep */
+  if (!timeout)
+    return rv;
+
+  sleep_usecs += g_get_monotonic_time() - start;
+
+  if (rv == 0)
+    current_source = WAKEUP_SOURCE_TIMEOUT;
+  else if (rv > 0)
+    current_source = wakeup_source_for(fds, nfds);
+  else
+    current_source = WAKEUP_SOURCE_OTHER;
+
+  sources[current_source].wakeups++;
+
+  return rv;
+}
+
+void
+wakeup_handler_cpu(const char *method, gint64 usecs)
+{
+  wakeup_handler_t *h;
+
+  if (!handlers)
+    return;
+
+  if (!(h = g_hash_table_lookup(handlers, method)))
+  {
+    h = g_new0(wakeup_handler_t, 1);
+    g_hash_table_insert(handlers, g_strdup(method), h);
+  }
+
+  h->calls++;
+  h->cpu_usecs += usecs;
+}
+
+static gint64
+wakeup_now_seconds(void)
+{
+  return g_get_monotonic_time() / G_USEC_PER_SEC;
+}
+
+static gint
+wakeup_timer_compare(gconstpointer a, gconstpointer b)
+{
+  gint64 due_a = ((const wakeup_timer_t *)a)->due;
+  gint64 due_b = ((const wakeup_timer_t *)b)->due;
+
+  return due_a < due_b ? -1 : due_a > due_b;
+}
+
+static gboolean wakeup_tick(gpointer user_data);
+
+static void
+wakeup_tick_schedule(void)
+{
+  gint64 due;
+
+  if (!timers)
+  {
+    if (tick_id)
+    {
+      g_source_remove(tick_id);
+      tick_id = 0;
+    }
+
+    return;
+  }
+
+  due = ((wakeup_timer_t *)timers->data)->due;
+
+  if (tick_id)
+  {
+    if (tick_due == due)
+      return;
+
+    g_source_remove(tick_id);
+  }
+
+  tick_due = due;
+  tick_id = g_timeout_add_seconds(MAX(due - wakeup_now_seconds(), 0),
+                                  wakeup_tick, NULL);
+}
+
+static gboolean
+wakeup_tick(gpointer user_data)
+{
+  gint64 now = wakeup_now_seconds();
+
+  tick_id = 0;
+  tick_fires++;
+
+  /* everything due by now runs on this one wakeup */
+  while (timers && ((wakeup_timer_t *)timers->data)->due <= now)
+  {
+    GList *l = timers;
+
+    timers = g_list_remove_link(timers, l);
+    firing = g_list_concat(firing, l);
+  }
+
+  while (firing)
+  {
+    wakeup_timer_t *timer = firing->data;
+
+    if (!timer->removed)
+    {
+      timer_runs++;
+
+      if (timer->func(timer->data) && !timer->removed)
+      {
+        firing = g_list_delete_link(firing, firing);
+        timer->due = now + timer->interval;
+        timers = g_list_insert_sorted(timers, timer, wakeup_timer_compare);
+        continue;
+      }
+    }
+
+    firing = g_list_delete_link(firing, firing);
+    g_free(timer);
+  }
+
+  wakeup_tick_schedule();
+
+  return FALSE;
+}
+
+guint
+systemui_timeout_add_seconds(guint interval, GSourceFunc func, gpointer data)
+{
+  wakeup_timer_t *timer;
+
+  g_return_val_if_fail(func != NULL, 0);
+
+  timer = g_new0(wakeup_timer_t, 1);
+  timer->id = ++last_timer_id;
+  timer->due = wakeup_now_seconds() + interval;
+  timer->interval = interval;
+  timer->func = func;
+  timer->data = data;
+  timers = g_list_insert_sorted(timers, timer, wakeup_timer_compare);
+  wakeup_tick_schedule();
+
+  return timer->id;
+}
+
+void
+systemui_timeout_remove(guint id)
+{
+  GList *l;
+
+  for (l = firing; l; l = l->next)
+  {
+    wakeup_timer_t *timer = l->data;
+
+    if (timer->id == id)
+    {
+      timer->removed = TRUE;
+      return;
+    }
+  }
+
+  for (l = timers; l; l = l->next)
+  {
+    wakeup_timer_t *timer = l->data;
+
+    if (timer->id == id)
+    {
+      timers = g_list_delete_link(timers, l);
+      g_free(timer);
+      wakeup_tick_schedule();
+      return;
+    }
+  }
+}
+
+static void
+wakeup_handler_print(gpointer key, gpointer value, gpointer user_data)
+{
+  wakeup_handler_t *h = value;
+
+  g_string_append_printf(user_data, "handler %s calls=%u cpu_us=%lld\n",
+                         (const char *)key, h->calls,
+                         (long long)h->cpu_usecs);
+}
+
+static int
+wakeup_report_handler(const char *interface, const char *method,
+                      GArray *args, system_ui_data *ui,
+                      system_ui_handler_arg *result)
+{
+  GString *s = g_string_sized_new(1024);
+  gint64 elapsed = g_get_monotonic_time() - since;
+  gint64 cpu = 0;
+  guint total = 0;
+  guint i;
+
+  for (i = 0; i < n_sources; i++)
+  {
+    total += sources[i].wakeups;
+    cpu += sources[i].cpu_usecs;
+  }
+
+  g_string_append_printf(
+        s, "wakeups total=%u per_min=%.1f elapsed_s=%lld sleep_us=%lld "
+        "cpu_us=%lld\n", total,
+        elapsed > 0 ? total * 60.0 * G_USEC_PER_SEC / elapsed : 0.0,
+        (long long)(elapsed / G_USEC_PER_SEC), (long long)sleep_usecs,
+        (long long)cpu);
+
+  for (i = 0; i < n_sources; i++)
+  {
+    g_string_append_printf(s, "source %s wakeups=%u cpu_us=%lld\n",
+                           sources[i].name, sources[i].wakeups,
+                           (long long)sources[i].cpu_usecs);
+  }
+
+  g_string_append_printf(s, "tick fires=%u timer_runs=%u pending=%u\n",
+                         tick_fires, timer_runs, g_list_length(timers));
+  g_hash_table_foreach(handlers, wakeup_handler_print, s);
+  plugin_print_cpu(s);
+
+  return dbus_reply_string(result, g_string_free(s, FALSE));
+}
+
+void
+wakeup_reset_stats(void)
+{
+  guint i;
+
+  for (i = 0; i < n_sources; i++)
+  {
+    sources[i].wakeups = 0;
+    sources[i].cpu_usecs = 0;
+  }
+
+  sleep_usecs = 0;
+  tick_fires = 0;
+  timer_runs = 0;
+  since = g_get_monotonic_time();
+
+  if (handlers)
+    g_hash_table_remove_all(handlers);
+}
+
+gboolean
+wakeup_init(system_ui_data *ui)
+{
+  GMainContext *context = g_main_context_default();
+
+  handlers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  since = g_get_monotonic_time();
+  awake_cpu = wakeup_thread_cpu_time();
+
+  poll_func = g_main_context_get_poll_func(context);
+  g_main_context_set_poll_func(context, wakeup_poll);
+
+  return systemui_add_handler(SYSTEMUI_WAKEUP_REQ, wakeup_report_handler, ui);
+}
+
+void
+wakeup_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_WAKEUP_REQ, ui);
+
+  if (poll_func)
+  {
+    g_main_context_set_poll_func(g_main_context_default(), poll_func);
+    poll_func = NULL;
+  }
+
+  if (tick_id)
+  {
+    g_source_remove(tick_id);
+    tick_id = 0;
+  }
+
+  g_list_free_full(timers, g_free);
+  timers = NULL;
+  g_list_free_full(firing, g_free);
+  firing = NULL;
+
+  g_hash_table_destroy(handlers);
+  handlers = NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef SYSTEMUI_WAKEUP_H
+#define SYSTEMUI_WAKEUP_H
+
+#define SYSTEMUI_WAKEUP_REQ "get_wakeups"
+
+/*
+ * Every return from the main loop poll that did not come back immediately
+ * is a wakeup. It is charged to the first watched descriptor that became
+ * ready, to "timeout" if none did, and so is the CPU time used until the
+ * loop polls again. Counters are cleared with reset_stats.
+ */
+
+/* CPU time used by the calling thread, in microseconds */
+gint64 wakeup_thread_cpu_time(void);
+
+/* name must stay valid */
+void wakeup_watch_fd(int fd, const char *name);
+/* method is the registered handler name, case variants must not add entries */
+void wakeup_handler_cpu(const char *method, gint64 usecs);
+
+void wakeup_reset_stats(void);
+
+gboolean wakeup_init(system_ui_data *ui);
+void wakeup_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_WAKEUP_H
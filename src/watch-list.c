@@ -0,0 +1,102 @@
+#include <systemui.h>
+
+#include "watch-list.h"
+
+static void
+watch_free(watch_list_t *list, watch_t *w)
+{
+  if (list->destroy_data && w->data)
+    list->destroy_data(w->data);
+
+  g_free(w);
+}
+
+guint
+watch_list_add(watch_list_t *list, GCallback func, gpointer data,
+               gpointer user_data)
+{
+  watch_t *w = g_new(watch_t, 1);
+
+  w->id = ++list->last_id;
+  w->func = func;
+  w->data = data;
+  w->user_data = user_data;
+  list->watches = g_list_append(list->watches, w);
+
+  return w->id;
+}
+
+void
+watch_list_remove(watch_list_t *list, guint id)
+{
+  GList *l;
+
+  for (l = list->watches; l; l = l->next)
+  {
+    watch_t *w = l->data;
+
+    if (w->id != id || !w->func)
+      continue;
+
+    /* unlinked once the list is not being called anymore */
+    if (list->calling)
+    {
+      w->func = NULL;
+      list->removed = TRUE;
+    }
+    else
+    {
+      list->watches = g_list_delete_link(list->watches, l);
+      watch_free(list, w);
+    }
+
+    break;
+  }
+}
+
+void
+watch_list_call(watch_list_t *list, watch_call_func call, gpointer call_data)
+{
+  GList *l;
+
+  list->calling++;
+
+  for (l = list->watches; l; l = l->next)
+  {
+    watch_t *w = l->data;
+
+    if (w->func)
+      call(w, call_data);
+  }
+
+  if (--list->calling || !list->removed)
+    return;
+
+  list->removed = FALSE;
+
+  for (l = list->watches; l; )
+  {
+    GList *next = l->next;
+    watch_t *w = l->data;
+
+    if (!w->func)
+    {
+      list->watches = g_list_delete_link(list->watches, l);
+      watch_free(list, w);
+    }
+
+    l = next;
+  }
+}
+
+void
+watch_list_clear(watch_list_t *list)
+{
+  while (list->watches)
+  {
+    watch_free(list, list->watches->data);
+    list->watches = g_list_delete_link(list->watches, list->watches);
+  }
+
+  list->removed = FALSE;
+}
@@ -0,0 +1,42 @@
+#ifndef SYSTEMUI_WATCH_LIST_H
+#define SYSTEMUI_WATCH_LIST_H
+
+/*
+ * Callbacks registered by id, called in the order they were added. A watch
+ * may remove itself or any other one while the list is being called, it is
+ * not called anymore from then on.
+ */
+struct watch
+{
+  guint id;
+  /* NULL once removed */
+  GCallback func;
+  /* what the watch is for, e.g. a key prefix, owned by the list */
+  gpointer data;
+  gpointer user_data;
+};
+typedef struct watch watch_t;
+
+struct watch_list
+{
+  GList *watches;
+  guint last_id;
+  guint calling;
+  gboolean removed;
+  GDestroyNotify destroy_data;
+};
+typedef struct watch_list watch_list_t;
+
+#define WATCH_LIST_INIT(destroy_data) { NULL, 0, 0, FALSE, (destroy_data) }
+
+/* casts func back and calls it if the watch is interested in call_data */
+typedef void (*watch_call_func)(watch_t *watch, gpointer call_data);
+
+guint watch_list_add(watch_list_t *list, GCallback func, gpointer data,
+                     gpointer user_data);
+void watch_list_remove(watch_list_t *list, guint id);
+void watch_list_call(watch_list_t *list, watch_call_func call,
+                     gpointer call_data);
+void watch_list_clear(watch_list_t *list);
+
+#endif // SYSTEMUI_WATCH_LIST_H
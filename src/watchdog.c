@@ -0,0 +1,297 @@
+#include <string.h>
+#include <osso-log.h>
+#include <systemui.h>
+
+#include "dbus.h"
+#include "settings.h"
+#include "stats.h"
+#include "watchdog.h"
+
+#define WATCHDOG_DEFAULT_THRESHOLD_MS 1000
+#define WATCHDOG_MARKER_DEPTH 4
+#define WATCHDOG_MARKER_SIZE 80
+/* what the main loop was doing if no marker was set */
+#define WATCHDOG_UNMARKED "main loop"
+
+struct watchdog_stall
+{
+  guint count;
+  stats_histogram_t duration;
+};
+typedef struct watchdog_stall watchdog_stall_t;
+
+/* when the main thread returned from poll, 0 while it is polling. Only
+ * written by the main thread, atomically */
+static gint64 busy_since = 0;
+/* bumped by the main thread whenever it returns from poll */
+static volatile gint heartbeat = 0;
+/* set while the watchdog thread waits for the main thread to wake up */
+static volatile gint parked = FALSE;
+
+/* the rest under lock, the watchdog thread only reads the markers */
+static GMutex lock;
+static GCond cond;
+static gboolean running = FALSE;
+/* busy_since of the stall the watchdog thread already noticed */
+static gint64 stall_since = 0;
+static gchar markers[WATCHDOG_MARKER_DEPTH][WATCHDOG_MARKER_SIZE];
+static guint depth = 0;
+static gchar stall_marker[WATCHDOG_MARKER_SIZE];
+
+static gint64 threshold = 0;
+static GThread *thread = NULL;
+static GPollFunc poll_func = NULL;
+
+/* main thread only, marker -> watchdog_stall_t */
+static GHashTable *stalls = NULL;
+static gint64 longest = 0;
+
+static const char *
+watchdog_current(void)
+{
+  return depth ? markers[MIN(depth, WATCHDOG_MARKER_DEPTH) - 1] :
+                 WATCHDOG_UNMARKED;
+}
+
+void
+watchdog_enter(const char *kind, const char *name, const char *owner)
+{
+  if (!running)
+    return;
+
+  g_mutex_lock(&lock);
+
+  /* deeper ones are counted but charged to the last one that fits */
+  if (depth < WATCHDOG_MARKER_DEPTH)
+  {
+    g_snprintf(markers[depth], WATCHDOG_MARKER_SIZE, "%s:%s%s%s", kind,
+               name ? name : "", owner ? "@" : "", owner ? owner : "");
+  }
+
+  depth++;
+  g_mutex_unlock(&lock);
+}
+
+void
+watchdog_leave(void)
+{
+  if (!running)
+    return;
+
+  g_mutex_lock(&lock);
+
+  if (depth)
+    depth--;
+
+  g_mutex_unlock(&lock);
+}
+
+/* Ticks every threshold while the main loop is active and parks once it
+ * was idle for a whole tick, so busy main loop iterations do not wake it
+ * and an idle one does not either */
+static gpointer
+watchdog_run(gpointer data)
+{
+  gint seen = g_atomic_int_get(&heartbeat);
+
+  g_mutex_lock(&lock);
+
+  while (running)
+  {
+    gint64 since = __atomic_load_n(&busy_since, __ATOMIC_SEQ_CST);
+    gint64 now = g_get_monotonic_time();
+    gint64 deadline;
+
+    if (since && since != stall_since)
+    {
+      if (now >= since + threshold)
+      {
+        stall_since = since;
+        g_strlcpy(stall_marker, watchdog_current(), sizeof(stall_marker));
+        SYSTEMUI_WARNING("Main loop stalled for %lld ms in %s",
+                         (long long)((now - since) / 1000), stall_marker);
+        continue;
+      }
+
+      deadline = since + threshold;
+    }
+    else if (g_atomic_int_get(&heartbeat) != seen)
+    {
+      seen = g_atomic_int_get(&heartbeat);
+      deadline = now + threshold;
+    }
+    else
+    {
+      /* checked again once parked, the main thread only signals if it sees
+       * us parked */
+      g_atomic_int_set(&parked, TRUE);
+
+      if (g_atomic_int_get(&heartbeat) == seen)
+        g_cond_wait(&cond, &lock);
+
+      g_atomic_int_set(&parked, FALSE);
+      continue;
+    }
+
+    g_cond_wait_until(&cond, &lock, deadline);
+  }
+
+  g_mutex_unlock(&lock);
+
+  return NULL;
+}
+
+static void
+watchdog_record(const char *marker, gint64 usecs)
+{
+  watchdog_stall_t *stall = g_hash_table_lookup(stalls, marker);
+
+  if (!stall)
+  {
+    stall = g_new0(watchdog_stall_t, 1);
+    g_hash_table_insert(stalls, g_strdup(marker), stall);
+  }
+
+  stall->count++;
+  stats_histogram_add(&stall->duration, usecs);
+
+  if (usecs > longest)
+    longest = usecs;
+}
+
+static gint
+watchdog_poll(GPollFD *fds, guint nfds, gint timeout)
+{
+  gchar marker[WATCHDOG_MARKER_SIZE];
+  gint64 busy = g_get_monotonic_time() - busy_since;
+  gint rv;
+
+  /* busy_since is 0 on the first call */
+  if (busy_since && busy >= threshold)
+  {
+    g_mutex_lock(&lock);
+
+    /* whatever ran when it was noticed, what ran last otherwise */
+    g_strlcpy(marker, stall_since == busy_since ? stall_marker :
+                                                  watchdog_current(),
+              sizeof(marker));
+    __atomic_store_n(&busy_since, 0, __ATOMIC_SEQ_CST);
+    g_mutex_unlock(&lock);
+
+    watchdog_record(marker, busy);
+  }
+  else
+    __atomic_store_n(&busy_since, 0, __ATOMIC_SEQ_CST);
+
+  rv = poll_func(fds, nfds, timeout);
+
+  __atomic_store_n(&busy_since, g_get_monotonic_time(), __ATOMIC_SEQ_CST);
+  g_atomic_int_inc(&heartbeat);
+
+  /* only after the main loop was idle for longer than the threshold */
+  if (g_atomic_int_get(&parked))
+  {
+    g_mutex_lock(&lock);
+    g_cond_signal(&cond);
+    g_mutex_unlock(&lock);
+  }
+
+  return rv;
+}
+
+static void
+watchdog_stall_print(gpointer key, gpointer value, gpointer user_data)
+{
+  watchdog_stall_t *stall = value;
+  gchar *name = g_strdup_printf("stall %s count=%u duration",
+                                (const char *)key, stall->count);
+
+  stats_histogram_print(user_data, name, &stall->duration);
+  g_free(name);
+}
+
+static int
+watchdog_handler(const char *interface, const char *method, GArray *args,
+                 system_ui_data *ui, system_ui_handler_arg *result)
+{
+  GString *s = g_string_sized_new(512);
+
+  g_string_append_printf(s, "watchdog threshold_ms=%lld stalls=%u "
+                         "longest_us=%lld\n", (long long)(threshold / 1000),
+                         g_hash_table_size(stalls), (long long)longest);
+  g_hash_table_foreach(stalls, watchdog_stall_print, s);
+
+  return dbus_reply_string(result, g_string_free(s, FALSE));
+}
+
+void
+watchdog_reset_stats(void)
+{
+  if (stalls)
+    g_hash_table_remove_all(stalls);
+
+  longest = 0;
+}
+
+gboolean
+watchdog_init(system_ui_data *ui)
+{
+  GMainContext *context = g_main_context_default();
+  GError *error = NULL;
+  gint ms = settings_get_int(ui, SYSTEMUI_GCONF_WATCHDOG_THRESHOLD,
+                             WATCHDOG_DEFAULT_THRESHOLD_MS);
+
+  stalls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  if (!systemui_add_handler(SYSTEMUI_WATCHDOG_REQ, watchdog_handler, ui))
+    return FALSE;
+
+  if (ms <= 0)
+    return TRUE;
+
+  threshold = (gint64)ms * 1000;
+  g_mutex_init(&lock);
+  g_cond_init(&cond);
+  running = TRUE;
+
+  if (!(thread = g_thread_try_new("watchdog", watchdog_run, NULL, &error)))
+  {
+    SYSTEMUI_WARNING("Cannot start watchdog thread: %s", error->message);
+    g_error_free(error);
+    running = FALSE;
+    g_cond_clear(&cond);
+    g_mutex_clear(&lock);
+
+    return TRUE;
+  }
+
+  poll_func = g_main_context_get_poll_func(context);
+  g_main_context_set_poll_func(context, watchdog_poll);
+
+  return TRUE;
+}
+
+void
+watchdog_finish(system_ui_data *ui)
+{
+  systemui_remove_handler(SYSTEMUI_WATCHDOG_REQ, ui);
+
+  if (thread)
+  {
+    g_main_context_set_poll_func(g_main_context_default(), poll_func);
+    poll_func = NULL;
+
+    g_mutex_lock(&lock);
+    running = FALSE;
+    g_cond_signal(&cond);
+    g_mutex_unlock(&lock);
+
+    g_thread_join(thread);
+    thread = NULL;
+    g_cond_clear(&cond);
+    g_mutex_clear(&lock);
+  }
+
+  g_hash_table_destroy(stalls);
+  stalls = NULL;
+}
@@ -0,0 +1,28 @@
+#ifndef SYSTEMUI_WATCHDOG_H
+#define SYSTEMUI_WATCHDOG_H
+
+#define SYSTEMUI_WATCHDOG_REQ "get_stalls"
+
+/* main loop iterations taking longer are stalls, 0 disables the watchdog */
+#define SYSTEMUI_GCONF_WATCHDOG_THRESHOLD \
+  SYSTEMUI_GCONF_DIR "watchdog_threshold_ms"
+
+/*
+ * A thread watches how long the main thread has been away from polling.
+ * Once that exceeds the threshold the innermost dispatch marker is logged
+ * and the stall is charged to it when the main loop gets back to poll.
+ * The thread wakes up once per threshold while the main loop is active
+ * and sleeps for good once it was idle for that long, the main thread only
+ * wakes it when it gets going again after such an idle period.
+ */
+
+/* marks what the main thread is doing, owner (a plugin) may be NULL */
+void watchdog_enter(const char *kind, const char *name, const char *owner);
+void watchdog_leave(void);
+
+void watchdog_reset_stats(void);
+
+gboolean watchdog_init(system_ui_data *ui);
+void watchdog_finish(system_ui_data *ui);
+
+#endif // SYSTEMUI_WATCHDOG_H
@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# Cold start benchmark: starts systemui --headless with growing numbers of
+# synthetic plugins and reports time to SYSTEMUI_STARTED_SIG and peak RSS.
+#
+# usage: bench-startup.sh [-n "0 10 50 100"] [-s KIB] [-y SYMBOLS]
+#                         [-i INIT_USECS] [-r RUNS] [-l LOADGEN]
+#                         [-- LOADGEN OPTIONS]
+
+set -e
+
+counts="0 10 50 100"
+size=64
+symbols=100
+init_us=0
+runs=5
+loadgen="$(dirname "$0")/systemui-loadgen"
+CC=${CC:-cc}
+
+while getopts "n:s:y:i:r:l:" opt; do
+  case $opt in
+    n) counts=$OPTARG ;;
+    s) size=$OPTARG ;;
+    y) symbols=$OPTARG ;;
+    i) init_us=$OPTARG ;;
+    r) runs=$OPTARG ;;
+    l) loadgen=$OPTARG ;;
+    *) sed -n '6,8s/^# //p' "$0"; exit 2 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/systemui-bench-XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+
+# one object, copied under different names: dlopen() treats every copy as
+# a separate library
+{
+  echo "#include <time.h>"
+  echo
+  echo "/* initialised, so it takes up space in the file */"
+  echo "static volatile char payload[$size * 1024] = {1};"
+  echo
+  i=0
+  while [ $i -lt "$symbols" ]; do
+    echo "int synth_symbol_$i(int x) { return x + $i + payload[$i % sizeof(payload)]; }"
+    i=$((i + 1))
+  done
+  cat <<EOC
+
+static long long
+now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+int
+plugin_init(void *ui)
+{
+  long long end = now_us() + $init_us;
+  unsigned int i;
+  int sum = 0;
+
+  /* fault the payload in like relocations and data would */
+  for (i = 0; i < sizeof(payload); i += 4096)
+    sum += payload[i];
+
+  while (now_us() < end)
+    ;
+
+  return sum >= 0;
+}
+
+void
+plugin_close(void *ui)
+{
+}
+EOC
+} > "$tmp/synth.c"
+
+$CC -O2 -shared -fPIC -o "$tmp/synth.so" "$tmp/synth.c"
+
+printf "%8s %12s %12s %12s\n" plugins startup_us maxrss_kib so_bytes
+for n in $counts; do
+  dir="$tmp/plugins-$n"
+  mkdir "$dir"
+  i=0
+  while [ $i -lt "$n" ]; do
+    cp "$tmp/synth.so" "$dir/libsystemuiplugin_synth$i.so"
+    i=$((i + 1))
+  done
+
+  out=$("$loadgen" --startup="$runs" --plugin-path="$dir" "$@")
+  startup=$(echo "$out" | awk '$1 == "startup_us" { print $4 }')
+  rss=$(echo "$out" | awk '$1 == "maxrss_kib" { print $4 }')
+  printf "%8s %12s %12s %12s\n" "$n" "$startup" "$rss" \
+         "$(wc -c < "$tmp/synth.so")"
+  rm -rf "$dir"
+done
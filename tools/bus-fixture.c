@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <glib/gstdio.h>
+#include <systemui/dbus-names.h>
+
+#include "bus-fixture.h"
+
+#define STOP_TIMEOUT_MS 5000
+
+static const char *bus_config =
+  "<!DOCTYPE busconfig PUBLIC \"-//freedesktop//DTD D-BUS Bus Configuration 1.0//EN\"\n"
+  " \"http://www.freedesktop.org/standards/dbus/1.0/busconfig.dtd\">\n"
+  "<busconfig>\n"
+  "  <type>systemui-test</type>\n"
+  "  <listen>unix:path=%s/bus</listen>\n"
+  "  <auth>EXTERNAL</auth>\n"
+  "  <policy context=\"default\">\n"
+  "    <allow user=\"*\"/>\n"
+  "    <allow own=\"*\"/>\n"
+  "    <allow send_type=\"method_call\"/>\n"
+  "    <allow send_type=\"signal\"/>\n"
+  "    <allow send_requested_reply=\"true\" send_type=\"method_return\"/>\n"
+  "    <allow send_requested_reply=\"true\" send_type=\"error\"/>\n"
+  "    <allow receive_type=\"*\"/>\n"
+  "  </policy>\n"
+  "%s"
+  "</busconfig>\n";
+
+static guint plugin_dirs = 0;
+
+static void
+remove_tree(const char *path)
+{
+  GDir *dir = g_dir_open(path, 0, NULL);
+
+  if (dir)
+  {
+    const char *name;
+
+    while ((name = g_dir_read_name(dir)))
+    {
+      gchar *child = g_build_filename(path, name, NULL);
+
+      if (g_file_test(child, G_FILE_TEST_IS_DIR) &&
+          !g_file_test(child, G_FILE_TEST_IS_SYMLINK))
+      {
+        remove_tree(child);
+      }
+      else
+        g_unlink(child);
+
+      g_free(child);
+    }
+
+    g_dir_close(dir);
+  }
+
+  g_rmdir(path);
+}
+
+DBusConnection *
+bus_fixture_connect(bus_fixture_t *f)
+{
+  DBusConnection *conn;
+  DBusError error;
+
+  dbus_error_init(&error);
+  conn = dbus_connection_open_private(f->address, &error);
+
+  if (!conn || !dbus_bus_register(conn, &error))
+  {
+    g_warning("Cannot connect to %s: %s", f->address, error.message);
+    dbus_error_free(&error);
+
+    if (conn)
+    {
+      dbus_connection_close(conn);
+      dbus_connection_unref(conn);
+    }
+
+    return NULL;
+  }
+
+  dbus_connection_set_exit_on_disconnect(conn, FALSE);
+
+  return conn;
+}
+
+gchar *
+bus_fixture_write_settings(bus_fixture_t *f, gboolean ratelimit)
+{
+  gchar *file = g_build_filename(f->tmpdir, "settings.ini", NULL);
+  gchar *arg;
+
+  if (!g_file_set_contents(file, ratelimit ? "" : "[ratelimit]\nrate=0\n",
+                           -1, NULL))
+  {
+    g_warning("Cannot write %s", file);
+  }
+
+  arg = g_strconcat("--settings=", file, NULL);
+  g_free(file);
+
+  return arg;
+}
+
+gboolean
+bus_fixture_start_daemon(bus_fixture_t *f, const char *policy)
+{
+  gchar *config;
+  gchar *config_file;
+  gchar *include;
+  gchar *config_arg;
+  gchar *argv[5];
+  gint out = -1;
+  GError *error = NULL;
+  FILE *fp;
+  char line[1024];
+  gboolean ok;
+
+  memset(f, 0, sizeof(*f));
+
+  if (!(f->tmpdir = g_dir_make_tmp("systemui-bus-XXXXXX", &error)))
+  {
+    g_warning("Cannot create temporary directory: %s", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  include = policy ?
+        g_markup_printf_escaped("  <include ignore_missing=\"yes\">%s</include>\n",
+                                policy) :
+        g_strdup("");
+  config = g_strdup_printf(bus_config, f->tmpdir, include);
+  config_file = g_build_filename(f->tmpdir, "bus.conf", NULL);
+  ok = g_file_set_contents(config_file, config, -1, &error);
+  g_free(include);
+  g_free(config);
+
+  if (!ok)
+  {
+    g_warning("Cannot write %s: %s", config_file, error->message);
+    g_error_free(error);
+    g_free(config_file);
+    return FALSE;
+  }
+
+  config_arg = g_strconcat("--config-file=", config_file, NULL);
+  g_free(config_file);
+
+  argv[0] = "dbus-daemon";
+  argv[1] = config_arg;
+  argv[2] = "--nofork";
+  argv[3] = "--print-address";
+  argv[4] = NULL;
+
+  ok = g_spawn_async_with_pipes(NULL, argv, NULL,
+                                G_SPAWN_SEARCH_PATH |
+                                G_SPAWN_DO_NOT_REAP_CHILD,
+                                NULL, NULL, &f->daemon_pid, NULL, &out, NULL,
+                                &error);
+  g_free(config_arg);
+
+  if (!ok)
+  {
+    g_warning("Cannot start dbus-daemon: %s", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  fp = fdopen(out, "r");
+
+  if (!fp || !fgets(line, sizeof(line), fp))
+  {
+    g_warning("dbus-daemon did not print its address");
+
+    if (fp)
+      fclose(fp);
+    else
+      close(out);
+
+    return FALSE;
+  }
+
+  /* the daemon doesn't write anything else, keeping the pipe open would
+   * only make it block */
+  fclose(fp);
+  f->address = g_strdup(g_strchomp(line));
+
+  if (!(f->monitor = bus_fixture_connect(f)))
+    return FALSE;
+
+  dbus_bus_add_match(f->monitor,
+                     "type='signal',interface='" SYSTEMUI_SIGNAL_IF "',"
+                     "member='" SYSTEMUI_STARTED_SIG "'",
+                     NULL);
+  dbus_connection_flush(f->monitor);
+
+  return TRUE;
+}
+
+static gchar *
+bus_fixture_plugin_dir(bus_fixture_t *f, const char * const *plugins)
+{
+  gchar *name = g_strdup_printf("plugins-%u", plugin_dirs++);
+  gchar *dir = g_build_filename(f->tmpdir, name, NULL);
+
+  g_free(name);
+
+  if (g_mkdir(dir, 0700))
+  {
+    g_warning("Cannot create %s", dir);
+    g_free(dir);
+    return NULL;
+  }
+
+  for (; plugins && *plugins; plugins++)
+  {
+    char target[PATH_MAX];
+    gchar *base = g_path_get_basename(*plugins);
+    gchar *link = g_build_filename(dir, base, NULL);
+    int rv = realpath(*plugins, target) ? symlink(target, link) : -1;
+
+    g_free(base);
+    g_free(link);
+
+    if (rv)
+    {
+      g_warning("Cannot link plugin %s", *plugins);
+      g_free(dir);
+      return NULL;
+    }
+  }
+
+  return dir;
+}
+
+gboolean
+bus_fixture_start_systemui(bus_fixture_t *f, const char *systemui,
+                           const char *plugin_path,
+                           const char * const *plugins,
+                           const char * const *extra_args,
+                           guint timeout_ms, gint64 *startup_usecs)
+{
+  GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+  gchar **envp = g_get_environ();
+  gchar *dir;
+  GError *error = NULL;
+  gint64 start;
+  gint64 deadline;
+  gboolean ok;
+  gboolean started = FALSE;
+
+  if (plugin_path)
+    dir = g_strdup(plugin_path);
+  else if (!(dir = bus_fixture_plugin_dir(f, plugins)))
+    goto out;
+
+  g_ptr_array_add(argv, g_strdup(systemui));
+  g_ptr_array_add(argv, g_strdup("--headless"));
+  g_ptr_array_add(argv, g_strconcat("--plugin-path=", dir, NULL));
+  g_free(dir);
+
+  for (; extra_args && *extra_args; extra_args++)
+    g_ptr_array_add(argv, g_strdup(*extra_args));
+
+  g_ptr_array_add(argv, NULL);
+
+  envp = g_environ_setenv(envp, "DBUS_SYSTEM_BUS_ADDRESS", f->address, TRUE);
+  envp = g_environ_setenv(envp, "DBUS_SESSION_BUS_ADDRESS", f->address, TRUE);
+
+  start = g_get_monotonic_time();
+  deadline = start + (gint64)timeout_ms * 1000;
+  ok = g_spawn_async(NULL, (gchar **)argv->pdata, envp,
+                     G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL, &f->systemui_pid,
+                     &error);
+
+  if (!ok)
+  {
+    g_warning("Cannot start %s: %s", systemui, error->message);
+    g_error_free(error);
+    goto out;
+  }
+
+  while (!started && g_get_monotonic_time() < deadline)
+  {
+    DBusMessage *msg;
+
+    dbus_connection_read_write(f->monitor, 10);
+
+    while ((msg = dbus_connection_pop_message(f->monitor)))
+    {
+      if (dbus_message_is_signal(msg, SYSTEMUI_SIGNAL_IF,
+                                 SYSTEMUI_STARTED_SIG))
+      {
+        started = TRUE;
+      }
+
+      dbus_message_unref(msg);
+    }
+
+    if (!started && waitpid(f->systemui_pid, NULL, WNOHANG) > 0)
+    {
+      g_warning("%s exited during startup", systemui);
+      f->systemui_pid = 0;
+      goto out;
+    }
+  }
+
+  if (started)
+  {
+    if (startup_usecs)
+      *startup_usecs = g_get_monotonic_time() - start;
+  }
+  else
+  {
+    g_warning("%s did not start within %u ms", systemui, timeout_ms);
+    bus_fixture_stop_systemui(f, NULL);
+  }
+
+out:
+  g_ptr_array_free(argv, TRUE);
+  g_strfreev(envp);
+
+  return started;
+}
+
+static gboolean
+bus_fixture_reap(GPid pid, struct rusage *usage)
+{
+  struct rusage ru;
+  gint64 deadline = g_get_monotonic_time() + STOP_TIMEOUT_MS * 1000;
+  pid_t rv;
+
+  /* left as is if wait4() fails */
+  memset(&ru, 0, sizeof(ru));
+  kill(pid, SIGTERM);
+
+  while (!(rv = wait4(pid, NULL, WNOHANG, &ru)) &&
+         g_get_monotonic_time() < deadline)
+  {
+    g_usleep(10 * 1000);
+  }
+
+  if (!rv)
+  {
+    g_warning("Process %d did not exit, killing it", pid);
+    kill(pid, SIGKILL);
+    rv = wait4(pid, NULL, 0, &ru);
+  }
+
+  g_spawn_close_pid(pid);
+
+  if (usage)
+    *usage = ru;
+
+  return rv == pid;
+}
+
+gboolean
+bus_fixture_stop_systemui(bus_fixture_t *f, struct rusage *usage)
+{
+  gboolean rv;
+
+  if (!f->systemui_pid)
+    return FALSE;
+
+  rv = bus_fixture_reap(f->systemui_pid, usage);
+  f->systemui_pid = 0;
+
+  return rv;
+}
+
+void
+bus_fixture_stop(bus_fixture_t *f)
+{
+  bus_fixture_stop_systemui(f, NULL);
+
+  if (f->monitor)
+  {
+    dbus_connection_close(f->monitor);
+    dbus_connection_unref(f->monitor);
+    f->monitor = NULL;
+  }
+
+  if (f->daemon_pid)
+  {
+    bus_fixture_reap(f->daemon_pid, NULL);
+    f->daemon_pid = 0;
+  }
+
+  if (f->tmpdir)
+  {
+    remove_tree(f->tmpdir);
+    g_free(f->tmpdir);
+    f->tmpdir = NULL;
+  }
+
+  g_free(f->address);
+  f->address = NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef SYSTEMUI_BUS_FIXTURE_H
+#define SYSTEMUI_BUS_FIXTURE_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <glib.h>
+#include <dbus/dbus.h>
+
+/*
+ * A private dbus-daemon serving as both system and session bus, with
+ * systemui running --headless against it.
+ */
+typedef struct
+{
+  gchar *tmpdir;
+  gchar *address;
+  GPid daemon_pid;
+  GPid systemui_pid;
+  /* watches for SYSTEMUI_STARTED_SIG */
+  DBusConnection *monitor;
+} bus_fixture_t;
+
+/* policy is an extra busconfig file to include, may be NULL */
+gboolean bus_fixture_start_daemon(bus_fixture_t *f, const char *policy);
+
+/* plugins are linked into a fresh directory systemui loads them from,
+ * plugin_path is used as is instead if not NULL. Returns once systemui
+ * sent SYSTEMUI_STARTED_SIG, startup_usecs is the time that took */
+gboolean bus_fixture_start_systemui(bus_fixture_t *f, const char *systemui,
+                                    const char *plugin_path,
+                                    const char * const *plugins,
+                                    const char * const *extra_args,
+                                    guint timeout_ms, gint64 *startup_usecs);
+
+/* SIGTERMs systemui and waits for it, usage may be NULL */
+gboolean bus_fixture_stop_systemui(bus_fixture_t *f, struct rusage *usage);
+
+void bus_fixture_stop(bus_fixture_t *f);
+
+/* a private settings snapshot, rate limiting is off unless asked for.
+ * Returns the --settings argument for systemui */
+gchar *bus_fixture_write_settings(bus_fixture_t *f, gboolean ratelimit);
+
+/* a new private connection registered on the bus */
+DBusConnection *bus_fixture_connect(bus_fixture_t *f);
+
+#endif // SYSTEMUI_BUS_FIXTURE_H
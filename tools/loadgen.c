@@ -0,0 +1,695 @@
+/*
+ * systemui-loadgen - drives systemui through a private dbus-daemon
+ *
+ * Starts a private bus, runs systemui --headless against it with the stub
+ * plugin and lets several client connections send a mix of method calls,
+ * callback requests, window requests and signals at a target rate. Every
+ * client waits for each reply before sending its next request.
+ *
+ * With --startup it only measures how long systemui takes to come up and
+ * its peak RSS, see bench-startup.sh.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <systemui/dbus-names.h>
+
+#include "bus-fixture.h"
+
+#define LOADGEN_PATH "/com/nokia/system_ui/loadgen"
+#define LOADGEN_IF "com.nokia.system_ui.loadgen"
+#define LOADGEN_CALLBACK "callback"
+
+enum op
+{
+  OP_METHOD,
+  OP_CALLBACK,
+  OP_WINDOW,
+  OP_SIGNAL,
+  N_OPS
+};
+
+static const char *op_names[N_OPS] =
+{
+  "method",
+  "callback",
+  "window",
+  "signal"
+};
+
+typedef enum
+{
+  CALL_OK,
+  CALL_ERROR,
+  CALL_LIMITED,
+  CALL_TIMEOUT
+} call_result_t;
+
+typedef struct
+{
+  guint errors;
+  guint limited;
+  guint timeouts;
+  GArray *latencies; /* gint64 usecs of successful operations */
+} op_stats_t;
+
+typedef struct
+{
+  bus_fixture_t *fixture;
+  guint id;
+  gint64 interval; /* usecs between requests, 0 for no pacing */
+  gint64 deadline;
+  guint *mix;      /* cumulative weights */
+  guint timeout_ms;
+  guint late;
+  gboolean failed;
+  op_stats_t stats[N_OPS];
+} client_t;
+
+static const char *
+my_name(DBusConnection *conn)
+{
+  return dbus_bus_get_unique_name(conn);
+}
+
+static call_result_t
+call(DBusConnection *conn, DBusMessage *msg, guint timeout_ms)
+{
+  DBusError error;
+  DBusMessage *reply;
+  call_result_t rv = CALL_OK;
+
+  dbus_error_init(&error);
+  reply = dbus_connection_send_with_reply_and_block(conn, msg, timeout_ms,
+                                                    &error);
+  dbus_message_unref(msg);
+
+  if (reply)
+    dbus_message_unref(reply);
+  else
+  {
+    if (dbus_error_has_name(&error, DBUS_ERROR_LIMITS_EXCEEDED))
+      rv = CALL_LIMITED;
+    else if (dbus_error_has_name(&error, DBUS_ERROR_NO_REPLY) ||
+             dbus_error_has_name(&error, DBUS_ERROR_TIMEOUT))
+    {
+      rv = CALL_TIMEOUT;
+    }
+    else
+      rv = CALL_ERROR;
+
+    dbus_error_free(&error);
+  }
+
+  return rv;
+}
+
+static DBusMessage *
+request_new(const char *method)
+{
+  return dbus_message_new_method_call(SYSTEMUI_SERVICE, SYSTEMUI_REQUEST_PATH,
+                                      SYSTEMUI_REQUEST_IF, method);
+}
+
+/* waits for the callback carrying value, older ones are dropped */
+static call_result_t
+wait_callback(DBusConnection *conn, dbus_int32_t value, gint64 deadline)
+{
+  while (g_get_monotonic_time() < deadline)
+  {
+    DBusMessage *msg;
+
+    while ((msg = dbus_connection_pop_message(conn)))
+    {
+      dbus_int32_t got = 0;
+      gboolean match = dbus_message_is_method_call(msg, LOADGEN_IF,
+                                                   LOADGEN_CALLBACK) &&
+          dbus_message_get_args(msg, NULL, DBUS_TYPE_INT32, &got,
+                                DBUS_TYPE_INVALID) &&
+          got == value;
+
+      dbus_message_unref(msg);
+
+      if (match)
+        return CALL_OK;
+    }
+
+    if (!dbus_connection_read_write(
+          conn, MAX((deadline - g_get_monotonic_time()) / 1000, 1)))
+    {
+      return CALL_ERROR;
+    }
+  }
+
+  return CALL_TIMEOUT;
+}
+
+static call_result_t
+client_op(client_t *c, DBusConnection *conn, enum op op, guint32 seq)
+{
+  DBusMessage *msg = NULL;
+
+  switch (op)
+  {
+    case OP_METHOD:
+    {
+      if ((msg = request_new("loadgen_echo")))
+      {
+        dbus_message_append_args(msg, DBUS_TYPE_UINT32, &seq,
+                                 DBUS_TYPE_INVALID);
+      }
+
+      break;
+    }
+    case OP_CALLBACK:
+    {
+      const char *service = my_name(conn);
+      const char *path = LOADGEN_PATH;
+      const char *iface = LOADGEN_IF;
+      const char *method = LOADGEN_CALLBACK;
+      dbus_int32_t value = seq;
+      gint64 deadline = g_get_monotonic_time() + c->timeout_ms * 1000;
+      call_result_t rv;
+
+      if (!(msg = request_new("loadgen_callback")))
+        break;
+
+      dbus_message_append_args(msg,
+                               DBUS_TYPE_STRING, &service,
+                               DBUS_TYPE_STRING, &path,
+                               DBUS_TYPE_STRING, &iface,
+                               DBUS_TYPE_STRING, &method,
+                               DBUS_TYPE_INT32, &value,
+                               DBUS_TYPE_INVALID);
+
+      if ((rv = call(conn, msg, c->timeout_ms)) != CALL_OK)
+        return rv;
+
+      return wait_callback(conn, value, deadline);
+    }
+    case OP_WINDOW:
+    {
+      /* the cookie keeps identical requests from being coalesced */
+      dbus_uint32_t priority = 1 + seq % 300;
+
+      if ((msg = request_new("loadgen_window")))
+      {
+        dbus_message_append_args(msg,
+                                 DBUS_TYPE_UINT32, &priority,
+                                 DBUS_TYPE_UINT32, &seq,
+                                 DBUS_TYPE_INVALID);
+      }
+
+      break;
+    }
+    case OP_SIGNAL:
+    {
+      const char *state = "normal";
+      const char *locale = "C";
+      const char *action = "shutdown";
+      const char *reason = "loadgen";
+
+      switch (seq % 3)
+      {
+        case 0:
+          msg = dbus_message_new_signal("/com/nokia/thermalmanager",
+                                        "com.nokia.thermalmanager",
+                                        "thermal_state_change_ind");
+          dbus_message_append_args(msg, DBUS_TYPE_STRING, &state,
+                                   DBUS_TYPE_INVALID);
+          break;
+        case 1:
+          msg = dbus_message_new_signal("/org/freedesktop/DBus",
+                                        "com.nokia.LocaleChangeNotification",
+                                        "locale_changed");
+          dbus_message_append_args(msg, DBUS_TYPE_STRING, &locale,
+                                   DBUS_TYPE_INVALID);
+          break;
+        default:
+          msg = dbus_message_new_signal("/com/nokia/dsme/signal",
+                                        "com.nokia.dsme.signal",
+                                        "denied_req_ind");
+          dbus_message_append_args(msg,
+                                   DBUS_TYPE_STRING, &action,
+                                   DBUS_TYPE_STRING, &reason,
+                                   DBUS_TYPE_INVALID);
+      }
+
+      /* there is no reply, only the send is timed */
+      if (!msg || !dbus_connection_send(conn, msg, NULL))
+      {
+        if (msg)
+          dbus_message_unref(msg);
+
+        return CALL_ERROR;
+      }
+
+      dbus_connection_flush(conn);
+      dbus_message_unref(msg);
+
+      return CALL_OK;
+    }
+    default:
+      break;
+  }
+
+  if (!msg)
+    return CALL_ERROR;
+
+  return call(conn, msg, c->timeout_ms);
+}
+
+static gpointer
+client_run(gpointer data)
+{
+  client_t *c = data;
+  DBusConnection *conn = bus_fixture_connect(c->fixture);
+  GRand *rand = g_rand_new_with_seed(c->id);
+  gint64 next = g_get_monotonic_time();
+  guint32 seq = c->id << 24;
+
+  if (!conn)
+  {
+    c->failed = TRUE;
+    g_rand_free(rand);
+    return NULL;
+  }
+
+  while (g_get_monotonic_time() < c->deadline)
+  {
+    guint pick = g_rand_int_range(rand, 0, c->mix[N_OPS - 1]);
+    enum op op = 0;
+    gint64 start;
+    gint64 now;
+    call_result_t rv;
+
+    while (pick >= c->mix[op])
+      op++;
+
+    start = g_get_monotonic_time();
+    rv = client_op(c, conn, op, seq++);
+    now = g_get_monotonic_time();
+
+    switch (rv)
+    {
+      case CALL_OK:
+      {
+        gint64 latency = now - start;
+
+        g_array_append_val(c->stats[op].latencies, latency);
+        break;
+      }
+      case CALL_ERROR:
+        c->stats[op].errors++;
+        break;
+      case CALL_LIMITED:
+        c->stats[op].limited++;
+        break;
+      case CALL_TIMEOUT:
+        c->stats[op].timeouts++;
+        break;
+    }
+
+    if (c->interval)
+    {
+      next += c->interval;
+
+      if (next > now)
+        g_usleep(next - now);
+      else
+        c->late++;
+    }
+  }
+
+  dbus_connection_close(conn);
+  dbus_connection_unref(conn);
+  g_rand_free(rand);
+
+  return NULL;
+}
+
+static gint
+compare_latency(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gint64
+percentile(GArray *sorted, guint p)
+{
+  if (!sorted->len)
+    return 0;
+
+  return g_array_index(sorted, gint64, (sorted->len - 1) * p / 100);
+}
+
+/* starts systemui runs times, reporting the time until it is up and its
+ * peak RSS */
+static int
+run_startup(bus_fixture_t *f, const char *systemui, const char *plugin_path,
+            const char * const *plugins, const char * const *args,
+            guint runs)
+{
+  GArray *startup = g_array_new(FALSE, FALSE, sizeof(gint64));
+  GArray *rss = g_array_new(FALSE, FALSE, sizeof(gint64));
+  int rv = 0;
+  guint i;
+
+  for (i = 0; i < runs; i++)
+  {
+    struct rusage usage;
+    gint64 usecs;
+    gint64 maxrss;
+
+    if (!bus_fixture_start_systemui(f, systemui, plugin_path, plugins, args,
+                                    60000, &usecs) ||
+        !bus_fixture_stop_systemui(f, &usage))
+    {
+      rv = 1;
+      break;
+    }
+
+    /* KiB on Linux */
+    maxrss = usage.ru_maxrss;
+    g_array_append_val(startup, usecs);
+    g_array_append_val(rss, maxrss);
+  }
+
+  g_array_sort(startup, compare_latency);
+  g_array_sort(rss, compare_latency);
+
+  printf("%-10s %8s %10s %10s %10s\n", "", "runs", "min", "median", "max");
+  printf("%-10s %8u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+         " %10" G_GINT64_FORMAT "\n",
+         "startup_us", startup->len, percentile(startup, 0),
+         percentile(startup, 50), percentile(startup, 100));
+  printf("%-10s %8u %10" G_GINT64_FORMAT " %10" G_GINT64_FORMAT
+         " %10" G_GINT64_FORMAT "\n",
+         "maxrss_kib", rss->len, percentile(rss, 0), percentile(rss, 50),
+         percentile(rss, 100));
+
+  g_array_free(startup, TRUE);
+  g_array_free(rss, TRUE);
+
+  return rv;
+}
+
+/* "method:60,callback:20" into cumulative weights */
+static gboolean
+parse_mix(const char *s, guint *mix)
+{
+  gchar **parts = g_strsplit(s, ",", -1);
+  guint weights[N_OPS] = {0};
+  gboolean ok = TRUE;
+  guint total = 0;
+  int i;
+
+  for (i = 0; ok && parts[i]; i++)
+  {
+    gchar **kv = g_strsplit(parts[i], ":", 2);
+    int op;
+
+    ok = FALSE;
+
+    for (op = 0; kv[0] && kv[1] && op < N_OPS; op++)
+    {
+      if (!strcmp(kv[0], op_names[op]))
+      {
+        weights[op] = atoi(kv[1]);
+        ok = TRUE;
+      }
+    }
+
+    g_strfreev(kv);
+  }
+
+  g_strfreev(parts);
+
+  for (i = 0; i < N_OPS; i++)
+  {
+    total += weights[i];
+    mix[i] = total;
+  }
+
+  return ok && total;
+}
+
+static void
+usage(const char *program)
+{
+  fprintf(
+    stdout,
+    "Usage: %s [OPTION]...\n"
+    "Drive systemui through a private dbus-daemon and report latencies\n"
+    "\n"
+    "  -s, --systemui=PATH     systemui binary (%s)\n"
+    "  -p, --plugin=FILE       plugin to load, may be repeated (%s)\n"
+    "  -P, --plugin-path=DIR   load the plugins in DIR instead\n"
+    "      --policy=FILE       bus policy to include (%s)\n"
+    "  -c, --clients=N         client connections (4)\n"
+    "  -r, --rate=N            requests per second over all clients, 0 for\n"
+    "                          as fast as possible (1000)\n"
+    "  -d, --duration=SECONDS  (10)\n"
+    "  -m, --mix=MIX           op:weight,... of method, callback, window and\n"
+    "                          signal (method:60,callback:20,window:10,signal:10)\n"
+    "  -t, --timeout=MS        reply timeout (1000)\n"
+    "      --startup=RUNS      only start and stop systemui RUNS times and\n"
+    "                          report startup time and peak RSS\n"
+    "  -R, --ratelimit         keep systemui's default rate limits\n"
+    "      --help              display this help and exit\n",
+    program, SYSTEMUI_BIN, STUB_PLUGIN, SYSTEMUI_POLICY);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *systemui = SYSTEMUI_BIN;
+  const char *plugin_path = NULL;
+  const char *policy = SYSTEMUI_POLICY;
+  GPtrArray *plugins = g_ptr_array_new();
+  guint clients = 4;
+  guint rate = 1000;
+  guint duration = 10;
+  guint timeout_ms = 1000;
+  guint startup_runs = 0;
+  gboolean ratelimit = FALSE;
+  gchar *args[2] = {NULL, NULL};
+  guint mix[N_OPS];
+  bus_fixture_t fixture;
+  client_t *client;
+  GThread **threads;
+  gint64 startup;
+  gint64 start;
+  gint64 elapsed;
+  guint total = 0;
+  guint failures = 0;
+  guint late = 0;
+  int rv = 0;
+  int opt;
+  int i;
+  static struct option long_options[] =
+  {
+    {"systemui", 1, 0, 's'},
+    {"plugin", 1, 0, 'p'},
+    {"plugin-path", 1, 0, 'P'},
+    {"policy", 1, 0, 'y'},
+    {"clients", 1, 0, 'c'},
+    {"rate", 1, 0, 'r'},
+    {"duration", 1, 0, 'd'},
+    {"mix", 1, 0, 'm'},
+    {"timeout", 1, 0, 't'},
+    {"startup", 1, 0, 'S'},
+    {"ratelimit", 0, 0, 'R'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  parse_mix("method:60,callback:20,window:10,signal:10", mix);
+
+  while ((opt = getopt_long(argc, argv, "s:p:P:c:r:d:m:t:R", long_options,
+                            NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 's':
+        systemui = optarg;
+        break;
+      case 'p':
+        g_ptr_array_add(plugins, optarg);
+        break;
+      case 'P':
+        plugin_path = optarg;
+        break;
+      case 'y':
+        policy = optarg;
+        break;
+      case 'c':
+        clients = MAX(atoi(optarg), 1);
+        break;
+      case 'r':
+        rate = atoi(optarg);
+        break;
+      case 'd':
+        duration = atoi(optarg);
+        break;
+      case 'm':
+        if (!parse_mix(optarg, mix))
+        {
+          fprintf(stderr, "Invalid mix '%s'\n", optarg);
+          return 2;
+        }
+
+        break;
+      case 't':
+        timeout_ms = atoi(optarg);
+        break;
+      case 'S':
+        startup_runs = MAX(atoi(optarg), 1);
+        break;
+      case 'R':
+        ratelimit = TRUE;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (!plugins->len)
+    g_ptr_array_add(plugins, STUB_PLUGIN);
+
+  g_ptr_array_add(plugins, NULL);
+
+#if !GLIB_CHECK_VERSION(2, 32, 0)
+  g_thread_init(NULL);
+#endif
+  dbus_threads_init_default();
+
+  if (!bus_fixture_start_daemon(&fixture, policy))
+  {
+    bus_fixture_stop(&fixture);
+    return 1;
+  }
+
+  args[0] = bus_fixture_write_settings(&fixture, ratelimit);
+
+  if (startup_runs)
+  {
+    rv = run_startup(&fixture, systemui, plugin_path,
+                     (const char * const *)plugins->pdata,
+                     (const char * const *)args, startup_runs);
+    bus_fixture_stop(&fixture);
+    g_ptr_array_free(plugins, TRUE);
+    g_free(args[0]);
+
+    return rv;
+  }
+
+  if (!bus_fixture_start_systemui(&fixture, systemui, plugin_path,
+                                  (const char * const *)plugins->pdata,
+                                  (const char * const *)args, 10000,
+                                  &startup))
+  {
+    bus_fixture_stop(&fixture);
+    g_free(args[0]);
+    return 1;
+  }
+
+  printf("systemui started in %" G_GINT64_FORMAT " us\n", startup);
+
+  client = g_new0(client_t, clients);
+  threads = g_new0(GThread *, clients);
+  start = g_get_monotonic_time();
+
+  for (i = 0; i < clients; i++)
+  {
+    int op;
+
+    client[i].fixture = &fixture;
+    client[i].id = i + 1;
+    client[i].interval = rate ? (gint64)clients * G_USEC_PER_SEC / rate : 0;
+    client[i].deadline = start + (gint64)duration * G_USEC_PER_SEC;
+    client[i].mix = mix;
+    client[i].timeout_ms = timeout_ms;
+
+    for (op = 0; op < N_OPS; op++)
+      client[i].stats[op].latencies = g_array_new(FALSE, FALSE,
+                                                  sizeof(gint64));
+
+    threads[i] = g_thread_try_new("loadgen", client_run, &client[i], NULL);
+  }
+
+  for (i = 0; i < clients; i++)
+  {
+    if (threads[i])
+      g_thread_join(threads[i]);
+    else
+      client[i].failed = TRUE;
+  }
+
+  elapsed = g_get_monotonic_time() - start;
+
+  printf("%-9s %8s %7s %7s %8s %8s %8s %8s %8s\n", "op", "count", "errors",
+         "limited", "timeouts", "p50us", "p90us", "p99us", "maxus");
+
+  for (i = 0; i < N_OPS; i++)
+  {
+    op_stats_t sum = {0, 0, 0, g_array_new(FALSE, FALSE, sizeof(gint64))};
+    int j;
+
+    for (j = 0; j < clients; j++)
+    {
+      op_stats_t *s = &client[j].stats[i];
+
+      sum.errors += s->errors;
+      sum.limited += s->limited;
+      sum.timeouts += s->timeouts;
+      g_array_append_vals(sum.latencies, s->latencies->data,
+                          s->latencies->len);
+      g_array_free(s->latencies, TRUE);
+    }
+
+    g_array_sort(sum.latencies, compare_latency);
+    total += sum.latencies->len + sum.errors + sum.limited + sum.timeouts;
+    failures += sum.errors + sum.timeouts;
+
+    printf("%-9s %8u %7u %7u %8u %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+           " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+           op_names[i], sum.latencies->len, sum.errors, sum.limited,
+           sum.timeouts, percentile(sum.latencies, 50),
+           percentile(sum.latencies, 90), percentile(sum.latencies, 99),
+           percentile(sum.latencies, 100));
+
+    g_array_free(sum.latencies, TRUE);
+  }
+
+  for (i = 0; i < clients; i++)
+  {
+    late += client[i].late;
+
+    if (client[i].failed)
+    {
+      fprintf(stderr, "client %d failed to run\n", i + 1);
+      rv = 1;
+    }
+  }
+
+  printf("%u requests in %.2f s, %.1f/s, %u behind schedule\n", total,
+         (double)elapsed / G_USEC_PER_SEC,
+         total * (double)G_USEC_PER_SEC / MAX(elapsed, 1), late);
+
+  if (!bus_fixture_stop_systemui(&fixture, NULL))
+    rv = 1;
+
+  bus_fixture_stop(&fixture);
+  g_free(threads);
+  g_free(client);
+  g_ptr_array_free(plugins, TRUE);
+  g_free(args[0]);
+
+  return rv || failures ? 1 : 0;
+}
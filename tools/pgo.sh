@@ -0,0 +1,95 @@
+#!/bin/sh
+#
+# Profile guided build: benchmarks systemui as configured, rebuilds it
+# instrumented, trains it with systemui-loadgen (D-Bus traffic and window
+# show/hide in headless mode), rebuilds it with the profile and link-time
+# optimisation and reports the speedup. Run from the top build directory,
+# src/systemui is left optimised.
+#
+# usage: pgo.sh [-t TRAIN_FLAGS] [-b BENCH_FLAGS] [-r RUNS]
+
+set -e
+
+train="-r 0 -d 20"
+bench="-r 0 -d 10"
+runs=3
+loadgen=tools/systemui-loadgen
+MAKE=${MAKE:-make}
+
+while getopts "t:b:r:" opt; do
+  case $opt in
+    t) train=$OPTARG ;;
+    b) bench=$OPTARG ;;
+    r) runs=$OPTARG ;;
+    *) sed -n '9s/^# //p' "$0"; exit 2 ;;
+  esac
+done
+
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/systemui-pgo-XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+
+median() {
+  sort -n | awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+# "requests/s method_p50_us method_p99_us startup_us" of binary $1
+measure() {
+  : > "$tmp/rate"
+  : > "$tmp/p50"
+  : > "$tmp/p99"
+  i=0
+  while [ $i -lt "$runs" ]; do
+    "$loadgen" -s "$1" $bench > "$tmp/out"
+    awk '/ requests in / { sub("/s,", "", $6); print $6 }' "$tmp/out" \
+      >> "$tmp/rate"
+    awk '$1 == "method" { print $6 }' "$tmp/out" >> "$tmp/p50"
+    awk '$1 == "method" { print $8 }' "$tmp/out" >> "$tmp/p99"
+    i=$((i + 1))
+  done
+  startup=$("$loadgen" -s "$1" --startup=5 |
+            awk '$1 == "startup_us" { print $4 }')
+  echo "$(median < "$tmp/rate") $(median < "$tmp/p50")" \
+       "$(median < "$tmp/p99") $startup"
+}
+
+exported() {
+  nm -D --defined-only "$1" | awk '{ print $3 }' | sort
+}
+
+$MAKE -C tools
+$MAKE -C src clean
+$MAKE -C src PGO_CFLAGS= LTO_CFLAGS=
+cp src/systemui "$tmp/systemui.base"
+echo "measuring baseline"
+before=$(measure "$tmp/systemui.base")
+
+$MAKE pgo-generate
+$MAKE pgo-train PGO_TRAIN_FLAGS="$train"
+$MAKE pgo-use
+
+# plugins resolve these at dlopen() time
+exported "$tmp/systemui.base" > "$tmp/base.syms"
+exported src/systemui > "$tmp/pgo.syms"
+missing=$(comm -23 "$tmp/base.syms" "$tmp/pgo.syms")
+
+if [ -n "$missing" ]; then
+  echo "symbols no longer exported by the optimised build:" >&2
+  echo "$missing" >&2
+  exit 1
+fi
+
+echo "measuring optimised build"
+after=$(measure src/systemui)
+
+echo "$before $after" | awk '
+  function row(name, b, a, higher_better) {
+    printf "%-14s %12s %12s %9.2fx\n", name, b, a,
+           higher_better ? a / (b ? b : 1) : b / (a ? a : 1)
+  }
+  {
+    printf "%-14s %12s %12s %10s\n", "", "baseline", "pgo", "speedup"
+    row("requests/s", $1, $5, 1)
+    row("method_p50_us", $2, $6, 0)
+    row("method_p99_us", $3, $7, 0)
+    row("startup_us", $4, $8, 0)
+  }'
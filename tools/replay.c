@@ -0,0 +1,456 @@
+/*
+ * systemui-replay - feeds a systemui --record capture back into systemui
+ *
+ * Starts a private bus, runs systemui --headless against it and sends the
+ * captured method calls and signals at their original pace, scaled by
+ * --speed. Replies are not waited for before the next message is due, the
+ * time each one took is reported per method.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <systemui/dbus-names.h>
+
+#include "bus-fixture.h"
+#include "capture.h"
+
+typedef struct
+{
+  guint sent;
+  guint errors;
+  guint timeouts;
+  GArray *latencies; /* gint64 usecs of successful replies */
+} member_stats_t;
+
+typedef struct
+{
+  member_stats_t *stats;
+  gint64 sent;
+} pending_t;
+
+/* member -> member_stats_t */
+static GHashTable *members = NULL;
+static guint outstanding = 0;
+
+static guint32
+get_u32(const guint8 *p)
+{
+  guint32 v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return GUINT32_FROM_LE(v);
+}
+
+static guint64
+get_u64(const guint8 *p)
+{
+  guint64 v;
+
+  memcpy(&v, p, sizeof(v));
+
+  return GUINT64_FROM_LE(v);
+}
+
+static void
+member_stats_free(member_stats_t *s)
+{
+  g_array_free(s->latencies, TRUE);
+  g_free(s);
+}
+
+static member_stats_t *
+member_stats_get(DBusMessage *msg)
+{
+  gchar *key = g_strdup_printf(
+        "%s%s", dbus_message_get_type(msg) == DBUS_MESSAGE_TYPE_SIGNAL ?
+          "signal:" : "", dbus_message_get_member(msg));
+  member_stats_t *s = g_hash_table_lookup(members, key);
+
+  if (s)
+  {
+    g_free(key);
+    return s;
+  }
+
+  s = g_new0(member_stats_t, 1);
+  s->latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+  g_hash_table_insert(members, key, s);
+
+  return s;
+}
+
+static void
+reply_received(DBusPendingCall *call, void *user_data)
+{
+  pending_t *p = user_data;
+  DBusMessage *reply = dbus_pending_call_steal_reply(call);
+  gint64 usecs = g_get_monotonic_time() - p->sent;
+
+  if (!reply)
+    p->stats->errors++;
+  else if (dbus_message_get_type(reply) != DBUS_MESSAGE_TYPE_ERROR)
+    g_array_append_val(p->stats->latencies, usecs);
+  else if (dbus_message_is_error(reply, DBUS_ERROR_NO_REPLY) ||
+           dbus_message_is_error(reply, DBUS_ERROR_TIMEOUT))
+  {
+    p->stats->timeouts++;
+  }
+  else
+    p->stats->errors++;
+
+  if (reply)
+    dbus_message_unref(reply);
+
+  outstanding--;
+}
+
+/* the copy gets a fresh serial, the captured ones came from many senders */
+static gboolean
+replay_message(DBusConnection *conn, DBusMessage *captured, guint timeout_ms)
+{
+  DBusMessage *msg = dbus_message_copy(captured);
+  member_stats_t *stats = member_stats_get(captured);
+  DBusPendingCall *call = NULL;
+  pending_t *p;
+
+  if (!msg)
+    return FALSE;
+
+  stats->sent++;
+
+  if (dbus_message_get_type(msg) != DBUS_MESSAGE_TYPE_METHOD_CALL ||
+      dbus_message_get_no_reply(msg))
+  {
+    gboolean ok = dbus_connection_send(conn, msg, NULL);
+
+    dbus_message_unref(msg);
+
+    return ok;
+  }
+
+  if (!dbus_connection_send_with_reply(conn, msg, &call, timeout_ms) || !call)
+  {
+    dbus_message_unref(msg);
+    stats->errors++;
+
+    return FALSE;
+  }
+
+  p = g_new(pending_t, 1);
+  p->stats = stats;
+  p->sent = g_get_monotonic_time();
+  outstanding++;
+
+  if (!dbus_pending_call_set_notify(call, reply_received, p, g_free))
+  {
+    outstanding--;
+    g_free(p);
+  }
+
+  dbus_pending_call_unref(call);
+  dbus_message_unref(msg);
+
+  return TRUE;
+}
+
+/* dispatches replies until deadline, FALSE if the connection is gone */
+static gboolean
+wait_until(DBusConnection *conn, gint64 deadline)
+{
+  gint64 now;
+
+  while ((now = g_get_monotonic_time()) < deadline)
+  {
+    if (!dbus_connection_read_write_dispatch(
+          conn, MAX((deadline - now) / 1000, 1)))
+    {
+      return FALSE;
+    }
+  }
+
+  while (dbus_connection_dispatch(conn) == DBUS_DISPATCH_DATA_REMAINS)
+    ;
+
+  return TRUE;
+}
+
+static gint
+compare_latency(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *)a;
+  gint64 y = *(const gint64 *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gint64
+percentile(GArray *sorted, guint p)
+{
+  if (!sorted->len)
+    return 0;
+
+  return g_array_index(sorted, gint64, (sorted->len - 1) * p / 100);
+}
+
+static gint
+compare_names(gconstpointer a, gconstpointer b)
+{
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void
+print_report(void)
+{
+  GPtrArray *names = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer key;
+  guint i;
+
+  g_hash_table_iter_init(&iter, members);
+
+  while (g_hash_table_iter_next(&iter, &key, NULL))
+    g_ptr_array_add(names, key);
+
+  g_ptr_array_sort(names, compare_names);
+
+  printf("%-32s %7s %7s %8s %8s %8s %8s %8s\n", "member", "sent", "errors",
+         "timeouts", "p50us", "p90us", "p99us", "maxus");
+
+  for (i = 0; i < names->len; i++)
+  {
+    member_stats_t *s = g_hash_table_lookup(members, names->pdata[i]);
+
+    g_array_sort(s->latencies, compare_latency);
+    printf("%-32s %7u %7u %8u %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+           " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+           (const char *)names->pdata[i], s->sent, s->errors, s->timeouts,
+           percentile(s->latencies, 50), percentile(s->latencies, 90),
+           percentile(s->latencies, 99), percentile(s->latencies, 100));
+  }
+
+  g_ptr_array_free(names, TRUE);
+}
+
+static void
+usage(const char *program)
+{
+  fprintf(
+    stdout,
+    "Usage: %s [OPTION]... FILE\n"
+    "Replay a systemui --record capture and report reply latencies\n"
+    "\n"
+    "  -s, --systemui=PATH     systemui binary (%s)\n"
+    "  -p, --plugin=FILE       plugin to load, may be repeated (%s)\n"
+    "  -P, --plugin-path=DIR   load the plugins in DIR instead\n"
+    "      --policy=FILE       bus policy to include (%s)\n"
+    "  -x, --speed=FACTOR      replay FACTOR times as fast, 0 sends\n"
+    "                          everything at once (1)\n"
+    "  -t, --timeout=MS        reply timeout (5000)\n"
+    "  -R, --ratelimit         keep systemui's default rate limits\n"
+    "      --help              display this help and exit\n",
+    program, SYSTEMUI_BIN, STUB_PLUGIN, SYSTEMUI_POLICY);
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *systemui = SYSTEMUI_BIN;
+  const char *plugin_path = NULL;
+  const char *policy = SYSTEMUI_POLICY;
+  GPtrArray *plugins = g_ptr_array_new();
+  gdouble speed = 1.0;
+  guint timeout_ms = 5000;
+  gboolean ratelimit = FALSE;
+  gchar *args[2] = {NULL, NULL};
+  bus_fixture_t fixture;
+  DBusConnection *conn;
+  GError *error = NULL;
+  gchar *contents;
+  gsize length;
+  gsize offset;
+  gint64 startup;
+  gint64 start;
+  guint replayed = 0;
+  guint late = 0;
+  int rv = 0;
+  int opt;
+  static struct option long_options[] =
+  {
+    {"systemui", 1, 0, 's'},
+    {"plugin", 1, 0, 'p'},
+    {"plugin-path", 1, 0, 'P'},
+    {"policy", 1, 0, 'y'},
+    {"speed", 1, 0, 'x'},
+    {"timeout", 1, 0, 't'},
+    {"ratelimit", 0, 0, 'R'},
+    {"help", 0, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  while ((opt = getopt_long(argc, argv, "s:p:P:x:t:R", long_options,
+                            NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 's':
+        systemui = optarg;
+        break;
+      case 'p':
+        g_ptr_array_add(plugins, optarg);
+        break;
+      case 'P':
+        plugin_path = optarg;
+        break;
+      case 'y':
+        policy = optarg;
+        break;
+      case 'x':
+        speed = g_ascii_strtod(optarg, NULL);
+        break;
+      case 't':
+        timeout_ms = atoi(optarg);
+        break;
+      case 'R':
+        ratelimit = TRUE;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 2;
+    }
+  }
+
+  if (optind != argc - 1 || speed < 0)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (!g_file_get_contents(argv[optind], &contents, &length, &error))
+  {
+    fprintf(stderr, "%s\n", error->message);
+    g_error_free(error);
+    return 1;
+  }
+
+  if (length < CAPTURE_HEADER_SIZE ||
+      memcmp(contents, CAPTURE_MAGIC, 8) ||
+      get_u32((guint8 *)contents + 8) != CAPTURE_VERSION)
+  {
+    fprintf(stderr, "%s is not a version %d capture\n", argv[optind],
+            CAPTURE_VERSION);
+    g_free(contents);
+    return 1;
+  }
+
+  if (!plugins->len)
+    g_ptr_array_add(plugins, STUB_PLUGIN);
+
+  g_ptr_array_add(plugins, NULL);
+  members = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)member_stats_free);
+
+  if (!bus_fixture_start_daemon(&fixture, policy))
+  {
+    bus_fixture_stop(&fixture);
+    g_free(contents);
+    return 1;
+  }
+
+  args[0] = bus_fixture_write_settings(&fixture, ratelimit);
+
+  if (!bus_fixture_start_systemui(&fixture, systemui, plugin_path,
+                                  (const char * const *)plugins->pdata,
+                                  (const char * const *)args, 10000,
+                                  &startup) ||
+      !(conn = bus_fixture_connect(&fixture)))
+  {
+    bus_fixture_stop(&fixture);
+    g_free(contents);
+    g_free(args[0]);
+    return 1;
+  }
+
+  printf("systemui started in %" G_GINT64_FORMAT " us\n", startup);
+
+  start = g_get_monotonic_time();
+
+  for (offset = CAPTURE_HEADER_SIZE;
+       offset + CAPTURE_RECORD_HEADER_SIZE <= length; )
+  {
+    const guint8 *header = (guint8 *)contents + offset;
+    guint64 timestamp = get_u64(header);
+    guint32 len = get_u32(header + 8);
+    DBusMessage *msg;
+    DBusError derror;
+    gint64 due;
+
+    offset += CAPTURE_RECORD_HEADER_SIZE;
+
+    if (len > length - offset)
+    {
+      fprintf(stderr, "Capture truncated after %u messages\n", replayed);
+      break;
+    }
+
+    dbus_error_init(&derror);
+
+    if (!(msg = dbus_message_demarshal(contents + offset, len, &derror)))
+    {
+      fprintf(stderr, "Invalid message at offset %lu: %s\n",
+              (unsigned long)offset, derror.message);
+      dbus_error_free(&derror);
+      offset += len;
+      continue;
+    }
+
+    offset += len;
+
+    if (speed > 0)
+    {
+      due = start + (gint64)(timestamp / speed);
+
+      if (g_get_monotonic_time() > due + 1000)
+        late++;
+      else if (!wait_until(conn, due))
+      {
+        dbus_message_unref(msg);
+        rv = 1;
+        break;
+      }
+    }
+
+    if (replay_message(conn, msg, timeout_ms))
+      replayed++;
+
+    dbus_message_unref(msg);
+  }
+
+  /* the last replies */
+  dbus_connection_flush(conn);
+
+  while (outstanding && !rv)
+  {
+    if (!dbus_connection_read_write_dispatch(conn, 100))
+      rv = 1;
+  }
+
+  printf("%u messages in %.2f s, %u behind schedule\n", replayed,
+         (double)(g_get_monotonic_time() - start) / G_USEC_PER_SEC, late);
+  print_report();
+
+  dbus_connection_close(conn);
+  dbus_connection_unref(conn);
+
+  if (!bus_fixture_stop_systemui(&fixture, NULL))
+    rv = 1;
+
+  bus_fixture_stop(&fixture);
+  g_hash_table_destroy(members);
+  g_ptr_array_free(plugins, TRUE);
+  g_free(contents);
+  g_free(args[0]);
+
+  return rv;
+}
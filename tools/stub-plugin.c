@@ -0,0 +1,115 @@
+/*
+ * Plugin driven by systemui-loadgen. It only answers requests, it never
+ * creates real windows, so systemui must run with --headless.
+ */
+#include <systemui.h>
+
+#define LOADGEN_ECHO_REQ "loadgen_echo"
+#define LOADGEN_CALLBACK_REQ "loadgen_callback"
+#define LOADGEN_WINDOW_REQ "loadgen_window"
+
+/* plain objects, the recording IPM backend never maps anything, but
+ * plugins must not pass what is not a GObject */
+static GObject *windows[4];
+static guint next_window = 0;
+
+static int
+loadgen_echo(const char *interface, const char *method, GArray *args,
+             system_ui_data *ui, system_ui_handler_arg *result)
+{
+  system_ui_handler_arg *arg;
+
+  if (args->len != 1)
+    return 0;
+
+  arg = &g_array_index(args, system_ui_handler_arg, 0);
+
+  if (arg->arg_type != DBUS_TYPE_UINT32)
+    return 0;
+
+  result->data.u32 = arg->data.u32;
+
+  return DBUS_TYPE_UINT32;
+}
+
+/* service, path, interface, method, int32 value to call back with */
+static int
+loadgen_callback(const char *interface, const char *method, GArray *args,
+                 system_ui_data *ui, system_ui_handler_arg *result)
+{
+  int supported_args[] = {DBUS_TYPE_INT32};
+  system_ui_callback_t callback = {NULL, NULL, NULL, NULL};
+  system_ui_handler_arg *value;
+
+  if (!systemui_check_plugin_arguments(args, supported_args,
+                                       G_N_ELEMENTS(supported_args)) ||
+      !systemui_check_set_callback(args, &callback))
+  {
+    return 0;
+  }
+
+  value = &g_array_index(args, system_ui_handler_arg, 4);
+  systemui_do_callback(ui, &callback, value->data.i32);
+  systemui_free_callback(&callback);
+
+  return DBUS_TYPE_VARIANT;
+}
+
+/* show and hide a window at the given priority, the second argument is
+ * ignored */
+static int
+loadgen_window(const char *interface, const char *method, GArray *args,
+               system_ui_data *ui, system_ui_handler_arg *result)
+{
+  GtkWidget *widget =
+      (GtkWidget *)windows[next_window++ % G_N_ELEMENTS(windows)];
+  system_ui_handler_arg *arg;
+
+  if (args->len != 2)
+    return 0;
+
+  arg = &g_array_index(args, system_ui_handler_arg, 0);
+
+  result->data.bool_val = WindowPriority_ShowWindow(widget, arg->data.u32) &&
+      WindowPriority_HideWindow(widget);
+
+  return DBUS_TYPE_BOOLEAN;
+}
+
+gboolean
+plugin_init(system_ui_data *ui)
+{
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS(windows); i++)
+    windows[i] = g_object_new(G_TYPE_OBJECT, NULL);
+
+  return systemui_add_handler_with_signature(LOADGEN_ECHO_REQ, loadgen_echo,
+                                             "u", ui) &&
+      systemui_add_handler_with_signature(LOADGEN_CALLBACK_REQ,
+                                          loadgen_callback, "ssssi", ui) &&
+      systemui_add_handler_with_signature(LOADGEN_WINDOW_REQ, loadgen_window,
+                                          "uu", ui);
+}
+
+void
+plugin_close(system_ui_data *ui)
+{
+  int i;
+
+  systemui_remove_handler(LOADGEN_WINDOW_REQ, ui);
+  systemui_remove_handler(LOADGEN_CALLBACK_REQ, ui);
+  systemui_remove_handler(LOADGEN_ECHO_REQ, ui);
+
+  for (i = 0; i < G_N_ELEMENTS(windows); i++)
+  {
+    g_object_unref(windows[i]);
+    windows[i] = NULL;
+  }
+}
+
+gboolean
+plugin_can_unload(system_ui_data *ui)
+{
+  return TRUE;
+}